@@ -29,6 +29,7 @@
 typedef mm_atomic_type(uint8_t) mm_atomic_uint8_t;
 typedef mm_atomic_type(uint16_t) mm_atomic_uint16_t;
 typedef mm_atomic_type(uint32_t) mm_atomic_uint32_t;
+typedef mm_atomic_type(uint64_t) mm_atomic_uint64_t;
 typedef mm_atomic_type(uintptr_t) mm_atomic_uintptr_t;
 typedef mm_atomic_type(void *) mm_atomic_ptr_t;
 
@@ -49,12 +50,24 @@ typedef mm_atomic_type(void *) mm_atomic_ptr_t;
 mm_atomic_cas(uint8)
 mm_atomic_cas(uint16)
 mm_atomic_cas(uint32)
+mm_atomic_cas(uint64)
 mm_atomic_cas(uintptr)
 mm_atomic_cas_type(void *, ptr)
 
 #undef mm_atomic_cas_type
 #undef mm_atomic_cas
 
+/**********************************************************************
+ * Atomic 64-bit load.
+ **********************************************************************/
+
+/* A plain 64-bit load might be torn so use a CAS that stores nothing new. */
+static inline uint64_t
+mm_atomic_uint64_load(mm_atomic_uint64_t *p)
+{
+	return __sync_val_compare_and_swap(p, 0, 0);
+}
+
 /**********************************************************************
  * Atomic arithmetics.
  **********************************************************************/
@@ -0,0 +1,33 @@
+/*
+ * arch/generic/tsc.h - MainMemory CPU timestamp counter.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_GENERIC_TSC_H
+#define ARCH_GENERIC_TSC_H
+
+#include <time.h>
+
+static inline uint64_t
+mm_cpu_tsc(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif /* ARCH_GENERIC_TSC_H */
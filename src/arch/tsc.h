@@ -0,0 +1,39 @@
+/*
+ * arch/tsc.h - MainMemory CPU timestamp counter.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_TSC_H
+#define ARCH_TSC_H
+
+#include "config.h"
+
+/*
+ * mm_cpu_tsc() reads a cheap CPU-local timestamp counter. It is meant for
+ * profiling short time intervals. Its values are not comparable across
+ * different CPUs and the units are not necessarily nanoseconds.
+ */
+
+#if ARCH_X86
+# include "arch/x86/tsc.h"
+#elif ARCH_X86_64
+# include "arch/x86-64/tsc.h"
+#else
+# include "arch/generic/tsc.h"
+#endif
+
+#endif /* ARCH_TSC_H */
@@ -31,6 +31,7 @@
 typedef mm_atomic_type(uint8_t) mm_atomic_uint8_t;
 typedef mm_atomic_type(uint16_t) mm_atomic_uint16_t;
 typedef mm_atomic_type(uint32_t) mm_atomic_uint32_t;
+typedef mm_atomic_type(uint64_t) mm_atomic_uint64_t;
 typedef mm_atomic_type(uintptr_t) mm_atomic_uintptr_t;
 typedef mm_atomic_type(void *) mm_atomic_ptr_t;
 
@@ -57,12 +58,23 @@ typedef mm_atomic_type(void *) mm_atomic_ptr_t;
 mm_atomic_cas(uint8, "cmpxchgb", "q")
 mm_atomic_cas(uint16, "cmpxchgw", "r")
 mm_atomic_cas(uint32, "cmpxchgl", "r")
+mm_atomic_cas(uint64, "cmpxchgq", "r")
 mm_atomic_cas(uintptr, "cmpxchgq", "r")
 mm_atomic_cas_type(void *, ptr, "cmpxchgq", "r")
 
 #undef mm_atomic_cas_type
 #undef mm_atomic_cas
 
+/**********************************************************************
+ * Atomic 64-bit load.
+ **********************************************************************/
+
+static inline uint64_t
+mm_atomic_uint64_load(mm_atomic_uint64_t *p)
+{
+	return *((volatile mm_atomic_uint64_t *) p);
+}
+
 /**********************************************************************
  * Atomic arithmetics.
  **********************************************************************/
@@ -0,0 +1,31 @@
+/*
+ * arch/x86-64/tsc.h - MainMemory CPU timestamp counter.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCH_X86_64_TSC_H
+#define ARCH_X86_64_TSC_H
+
+static inline uint64_t
+mm_cpu_tsc(void)
+{
+	uint32_t hi, lo;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return (uint64_t) hi << 32 | lo;
+}
+
+#endif /* ARCH_X86_64_TSC_H */
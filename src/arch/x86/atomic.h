@@ -31,6 +31,7 @@
 typedef mm_atomic_type(uint8_t) mm_atomic_uint8_t;
 typedef mm_atomic_type(uint16_t) mm_atomic_uint16_t;
 typedef mm_atomic_type(uint32_t) mm_atomic_uint32_t;
+typedef mm_atomic_type(uint64_t) mm_atomic_uint64_t;
 typedef mm_atomic_type(uintptr_t) mm_atomic_uintptr_t;
 typedef mm_atomic_type(void *) mm_atomic_ptr_t;
 
@@ -63,6 +64,28 @@ mm_atomic_cas_type(void *, ptr, "cmpxchgl", "r")
 #undef mm_atomic_cas_type
 #undef mm_atomic_cas
 
+static inline uint64_t
+mm_atomic_uint64_cas(mm_atomic_uint64_t *p, uint64_t c, uint64_t v)
+{
+	uint64_t r;
+	asm volatile(MM_LOCK_PREFIX "cmpxchg8b %1"
+		     : "=A"(r), "+m"(*p)
+		     : "b"((uint32_t) v), "c"((uint32_t) (v >> 32)), "0"(c)
+		     : "memory", "cc");
+	return r;
+}
+
+/**********************************************************************
+ * Atomic 64-bit load.
+ **********************************************************************/
+
+/* A plain 64-bit load might be torn so use a CAS that stores nothing new. */
+static inline uint64_t
+mm_atomic_uint64_load(mm_atomic_uint64_t *p)
+{
+	return mm_atomic_uint64_cas(p, 0, 0);
+}
+
 /**********************************************************************
  * Atomic arithmetics.
  **********************************************************************/
@@ -25,6 +25,7 @@
 
 #define MM_COMBINER_MINIMUM_HANDOFF	4
 #define MM_COMBINER_DEFAULT_HANDOFF	16
+#define MM_COMBINER_MAXIMUM_HANDOFF	256
 
 struct mm_combiner *
 mm_combiner_create(mm_combiner_routine_t routine,
@@ -70,9 +71,13 @@ mm_combiner_prepare(struct mm_combiner *combiner,
 		handoff = MM_COMBINER_DEFAULT_HANDOFF;
 	if (handoff < MM_COMBINER_MINIMUM_HANDOFF)
 		handoff = MM_COMBINER_MINIMUM_HANDOFF;
+	if (handoff > MM_COMBINER_MAXIMUM_HANDOFF)
+		handoff = MM_COMBINER_MAXIMUM_HANDOFF;
 
 	combiner->routine = routine;
+	combiner->sort = NULL;
 	combiner->handoff = handoff;
+	memset(&combiner->stat, 0, sizeof combiner->stat);
 
 	mm_ring_mpmc_prepare(&combiner->ring, size);
 	mm_ring_base_prepare_locks(&combiner->ring.base, MM_RING_LOCKED_GET);
@@ -80,11 +85,106 @@ mm_combiner_prepare(struct mm_combiner *combiner,
 	LEAVE();
 }
 
+void
+mm_combiner_set_sort(struct mm_combiner *combiner, mm_combiner_sort_t sort)
+{
+	combiner->sort = sort;
+}
+
+/**********************************************************************
+ * Combining pass.
+ **********************************************************************/
+
+// Take a request from the given ring slot if it is ready.
+static inline bool
+mm_combiner_take(struct mm_ring_mpmc *ring, uintptr_t head, uintptr_t *data)
+{
+	struct mm_ring_node *node = &ring->ring[head & ring->base.mask];
+	if (mm_memory_load(node->lock) != (head + 1))
+		return false;
+
+	mm_memory_load_fence();
+	*data = mm_memory_load(node->data);
+	mm_memory_fence(); /* TODO: load_store fence */
+	mm_memory_store(node->lock, head + 1 + ring->base.mask);
+	return true;
+}
+
+static uintptr_t
+mm_combiner_pass(struct mm_combiner *combiner, uintptr_t head)
+{
+	struct mm_ring_mpmc *ring = &combiner->ring;
+	uintptr_t first = head;
+
+	// Adapt the pass length to the queue depth. Serve the requests
+	// that are already queued but not too many of them as the caller
+	// has to wait for the pass to end.
+	uintptr_t depth = mm_memory_load(ring->base.tail) - head;
+	if (depth > combiner->handoff)
+		depth = combiner->handoff;
+	else if (depth < MM_COMBINER_MINIMUM_HANDOFF)
+		depth = MM_COMBINER_MINIMUM_HANDOFF;
+	uintptr_t last = head + depth;
+
+	if (combiner->sort == NULL) {
+		uintptr_t data;
+		while (head != last && mm_combiner_take(ring, head, &data)) {
+			(*combiner->routine)(data);
+			head++;
+		}
+	} else {
+		// Collect the requests ordering them by the key. Insertion
+		// sort is fine for such small batches and it is stable.
+		uintptr_t batch[MM_COMBINER_MAXIMUM_HANDOFF];
+		uintptr_t keys[MM_COMBINER_MAXIMUM_HANDOFF];
+		size_t n = 0;
+
+		uintptr_t data;
+		while (head != last && mm_combiner_take(ring, head, &data)) {
+			uintptr_t key = (*combiner->sort)(data);
+			size_t i = n++;
+			while (i > 0 && keys[i - 1] > key) {
+				batch[i] = batch[i - 1];
+				keys[i] = keys[i - 1];
+				i--;
+			}
+			batch[i] = data;
+			keys[i] = key;
+			head++;
+		}
+
+		for (size_t i = 0; i < n; i++)
+			(*combiner->routine)(batch[i]);
+	}
+
+	struct mm_combiner_stat *stat = &combiner->stat;
+	uintptr_t n = head - first;
+	stat->npasses++;
+	stat->nrequests += n;
+	if (stat->nbatch_max < n)
+		stat->nbatch_max = n;
+	if (head == last) {
+		struct mm_ring_node *node = &ring->ring[head & ring->base.mask];
+		if (mm_memory_load(node->lock) == (head + 1))
+			stat->nhandoffs++;
+	}
+
+	return head;
+}
+
+/**********************************************************************
+ * Combining execution.
+ **********************************************************************/
+
 void
 mm_combiner_execute(struct mm_combiner *combiner, uintptr_t data)
 {
 	ENTER();
 
+#if ENABLE_LOCK_STATS
+	uint64_t start = mm_cpu_tsc();
+#endif
+
 	// Get a request slot in the bounded MPMC queue shared between cores.
 	struct mm_ring_mpmc *ring = &combiner->ring;
 	uintptr_t tail = mm_atomic_uintptr_fetch_and_add(&ring->base.tail, 1);
@@ -102,35 +202,35 @@ mm_combiner_execute(struct mm_combiner *combiner, uintptr_t data)
 	mm_memory_store(node->lock, tail + 1);
 
 	// Wait until the request is executed.
+	uintptr_t handoff = combiner->handoff;
 	backoff = 0;
 	do {
 		// Check if it is actually our turn to execute the requests.
 		uintptr_t head = mm_memory_load(ring->base.head);
 		if (head == tail) {
-			uintptr_t last = tail + combiner->handoff;
-			while (head != last) {
-				struct mm_ring_node *node = &ring->ring[head & ring->base.mask];
-				if (mm_memory_load(node->lock) != (head + 1))
-					break;
-
-				mm_memory_load_fence();
-				uintptr_t data = mm_memory_load(node->data);
-				mm_memory_fence(); /* TODO: load_store fence */
-				mm_memory_store(node->lock, head + 1 + ring->base.mask);
-
-				(*combiner->routine)(data);
-
-				head = head + 1;
-			}
+#if ENABLE_LOCK_STATS
+			combiner->stat.wait_time += mm_cpu_tsc() - start;
+#endif
+			head = mm_combiner_pass(combiner, head);
 
 			mm_memory_fence();
 			mm_memory_store(ring->base.head, head);
-			break;
+			goto leave;
 		}
 
-		backoff = mm_backoff(backoff);
+		// A request that is going to be served by the current pass
+		// is polled eagerly, others back off.
+		if ((tail - head) <= handoff)
+			mm_spin_pause();
+		else
+			backoff = mm_backoff(backoff);
 
 	} while (mm_memory_load(node->lock) == (tail + 1));
 
+#if ENABLE_LOCK_STATS
+	combiner->stat.wait_time += mm_cpu_tsc() - start;
+#endif
+
+leave:
 	LEAVE();
 }
@@ -25,12 +25,39 @@
 
 typedef void (*mm_combiner_routine_t)(uintptr_t data);
 
+/* A routine that gives the key to order requests in a combining pass. */
+typedef uintptr_t (*mm_combiner_sort_t)(uintptr_t data);
+
+/* Combiner statistics. These are updated only by the thread that runs
+   the combining pass so they need no synchronization. */
+struct mm_combiner_stat
+{
+	/* The number of combining passes. */
+	uint64_t npasses;
+	/* The number of executed requests. */
+	uint64_t nrequests;
+	/* The number of passes that stopped at the handoff limit leaving
+	   ready requests to the next combiner. */
+	uint64_t nhandoffs;
+	/* The maximum number of requests executed in a pass. */
+	uint64_t nbatch_max;
+#if ENABLE_LOCK_STATS
+	/* The total request wait time in timestamp counter ticks. This
+	   one is updated by every requester so it is only approximate. */
+	uint64_t wait_time;
+#endif
+};
+
 struct mm_combiner
 {
 	mm_combiner_routine_t routine;
+	mm_combiner_sort_t sort;
 
+	/* The maximum number of requests executed in a pass. */
 	size_t handoff;
 
+	struct mm_combiner_stat stat;
+
 	struct mm_ring_mpmc ring;
 };
 
@@ -45,6 +72,11 @@ void mm_combiner_prepare(struct mm_combiner *combiner,
 			 size_t size, size_t handoff)
 	__attribute__((nonnull(1)));
 
+/* Make the combiner execute every batch of requests in the order of
+   the given keys. The order of requests with equal keys is retained. */
+void mm_combiner_set_sort(struct mm_combiner *combiner, mm_combiner_sort_t sort)
+	__attribute__((nonnull(1)));
+
 void mm_combiner_execute(struct mm_combiner *combiner, uintptr_t data)
 	__attribute__((nonnull(1)));
 
@@ -37,8 +37,13 @@
 
 #include "base/util/format.h"
 
+#include <stdio.h>
+
 #define MM_LOCK_STAT_TABLE_SIZE		509
 
+// The number of the most contended locks to show.
+#define MM_LOCK_STAT_TOP		8
+
 // Lock statistics entry for domain threads.
 struct mm_lock_domain_stat
 {
@@ -257,8 +262,7 @@ mm_lock_get_domain_stat(struct mm_lock_stat_set *stat_set,
 	MM_CDATA_ALLOC(domain, name, dom_stat->stat);
 	for (mm_core_t c = 0; c < domain->nthreads; c++) {
 		struct mm_lock_stat *stat = MM_CDATA_DEREF(c, dom_stat->stat);
-		stat->lock_count = 0;
-		stat->fail_count = 0;
+		memset(stat, 0, sizeof(struct mm_lock_stat));
 	}
 	mm_global_free(name);
 
@@ -287,8 +291,7 @@ mm_lock_get_thread_stat(struct mm_lock_stat_set *stat_set,
 	// If not found create a new entry.
 	thr_stat = mm_global_alloc(sizeof(struct mm_lock_thread_stat));
 	thr_stat->thread = thread;
-	thr_stat->stat.lock_count = 0;
-	thr_stat->stat.fail_count = 0;
+	memset(&thr_stat->stat, 0, sizeof(struct mm_lock_stat));
 
 	// Link the entry into list.
 	struct mm_link *head = mm_link_shared_head(&stat_set->thread_list);
@@ -321,6 +324,86 @@ mm_lock_getstat(struct mm_lock_stat_info *info)
 }
 
 
+static void
+mm_lock_add_stat(struct mm_lock_stat *sum, const struct mm_lock_stat *stat)
+{
+	sum->lock_count += stat->lock_count;
+	sum->fail_count += stat->fail_count;
+	sum->wait_time += stat->wait_time;
+	sum->hold_time += stat->hold_time;
+	for (int i = 0; i < MM_LOCK_STAT_HIST; i++) {
+		sum->wait_hist[i] += stat->wait_hist[i];
+		sum->hold_hist[i] += stat->hold_hist[i];
+	}
+}
+
+static void
+mm_lock_sum_stat_set(struct mm_lock_stat_summary *summary,
+		     struct mm_lock_stat_set *stat_set)
+{
+	summary->location = stat_set->location;
+	summary->moreinfo = stat_set->moreinfo;
+	memset(&summary->stat, 0, sizeof(struct mm_lock_stat));
+
+	struct mm_link *dom_link = mm_link_shared_head(&stat_set->domain_list);
+	while (dom_link != NULL) {
+		struct mm_lock_domain_stat *dom_stat
+			= containerof(dom_link, struct mm_lock_domain_stat, link);
+		struct mm_domain *domain = dom_stat->domain;
+		for (mm_core_t c = 0; c < domain->nthreads; c++) {
+			struct mm_lock_stat *stat = MM_CDATA_DEREF(c, dom_stat->stat);
+			mm_lock_add_stat(&summary->stat, stat);
+		}
+		dom_link = mm_memory_load(dom_link->next);
+	}
+
+	struct mm_link *thr_link = mm_link_shared_head(&stat_set->thread_list);
+	while (thr_link != NULL) {
+		struct mm_lock_thread_stat *thr_stat
+			= containerof(thr_link, struct mm_lock_thread_stat, link);
+		mm_lock_add_stat(&summary->stat, &thr_stat->stat);
+		thr_link = mm_memory_load(thr_link->next);
+	}
+}
+
+size_t
+mm_lock_stat_top(struct mm_lock_stat_summary *top, size_t n)
+{
+	size_t count = 0;
+	if (n == 0)
+		return 0;
+
+	struct mm_lock_stat_summary summary;
+	struct mm_link *set_link = mm_link_shared_head(&mm_lock_stat_list);
+	while (set_link != NULL) {
+		struct mm_lock_stat_set *stat_set
+			= containerof(set_link, struct mm_lock_stat_set, common_link);
+		mm_memory_load_fence();
+
+		mm_lock_sum_stat_set(&summary, stat_set);
+
+		// Insert the summary into the array sorted by the wait time.
+		size_t i = count;
+		if (count < n)
+			count++;
+		else if (summary.stat.wait_time <= top[n - 1].stat.wait_time)
+			i = n;
+		else
+			i = n - 1;
+		if (i < n) {
+			while (i > 0 && top[i - 1].stat.wait_time < summary.stat.wait_time) {
+				top[i] = top[i - 1];
+				i--;
+			}
+			top[i] = summary;
+		}
+
+		set_link = mm_memory_load(set_link->next);
+	}
+
+	return count;
+}
+
 static void
 mm_lock_print_stat(const struct mm_thread *thread,
 		   const struct mm_lock_stat_set *stat_set,
@@ -330,11 +413,55 @@ mm_lock_print_stat(const struct mm_thread *thread,
 	if (stat_set->moreinfo != NULL)
 		mm_verbose("lock %s (%s), %s, locked %llu, failed %llu",
 			stat_set->location, stat_set->moreinfo, name,
-			stat->lock_count, stat->fail_count);
+			(unsigned long long) stat->lock_count,
+			(unsigned long long) stat->fail_count);
 	else
 		mm_verbose("lock %s, %s, locked %llu, failed %llu",
 			stat_set->location, name,
-			stat->lock_count, stat->fail_count);
+			(unsigned long long) stat->lock_count,
+			(unsigned long long) stat->fail_count);
+}
+
+static void
+mm_lock_print_hist(const char *name, const uint64_t *hist)
+{
+	char buffer[MM_LOCK_STAT_HIST * 24];
+	size_t size = 0;
+
+	for (int i = 0; i < MM_LOCK_STAT_HIST; i++) {
+		if (hist[i] == 0)
+			continue;
+		int n = snprintf(buffer + size, sizeof buffer - size,
+				 " %d:%llu", i, (unsigned long long) hist[i]);
+		if (n < 0 || (size_t) n >= sizeof buffer - size)
+			break;
+		size += n;
+	}
+	buffer[size] = 0;
+
+	mm_verbose("  %s log2 histogram:%s", name, buffer);
+}
+
+static void
+mm_lock_print_summary(const struct mm_lock_stat_summary *summary)
+{
+	const struct mm_lock_stat *stat = &summary->stat;
+	if (summary->moreinfo != NULL)
+		mm_verbose("lock %s (%s), locked %llu, failed %llu, wait %llu, hold %llu",
+			summary->location, summary->moreinfo,
+			(unsigned long long) stat->lock_count,
+			(unsigned long long) stat->fail_count,
+			(unsigned long long) stat->wait_time,
+			(unsigned long long) stat->hold_time);
+	else
+		mm_verbose("lock %s, locked %llu, failed %llu, wait %llu, hold %llu",
+			summary->location,
+			(unsigned long long) stat->lock_count,
+			(unsigned long long) stat->fail_count,
+			(unsigned long long) stat->wait_time,
+			(unsigned long long) stat->hold_time);
+	mm_lock_print_hist("wait", stat->wait_hist);
+	mm_lock_print_hist("hold", stat->hold_hist);
 }
 
 #endif
@@ -374,5 +501,14 @@ mm_lock_stats(void)
 
 		set_link = mm_memory_load(set_link->next);
 	}
+
+	// Show the most contended locks.
+	struct mm_lock_stat_summary top[MM_LOCK_STAT_TOP];
+	size_t n = mm_lock_stat_top(top, MM_LOCK_STAT_TOP);
+	if (n != 0) {
+		mm_verbose("top %zu contended locks:", n);
+		for (size_t i = 0; i < n; i++)
+			mm_lock_print_summary(&top[i]);
+	}
 #endif
 }
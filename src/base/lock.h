@@ -21,8 +21,12 @@
 #define BASE_LOCK_H
 
 #include "common.h"
+#include "arch/atomic.h"
 #include "arch/lock.h"
+#include "arch/memory.h"
+#include "arch/tsc.h"
 #include "base/backoff.h"
+#include "base/bitops.h"
 
 /**********************************************************************
  * Basic TAS(TATAS) Spin Locks.
@@ -60,11 +64,22 @@ mm_global_unlock(mm_lock_t *lock)
 				  .location = __LOCATION__,	\
 				  .moreinfo = NULL }
 
+/* The number of log2 buckets in lock time histograms. */
+#define MM_LOCK_STAT_HIST	32
+
 /* Per-thread statistics entry for a lock. */
 struct mm_lock_stat
 {
 	uint64_t lock_count;
 	uint64_t fail_count;
+
+	/* Total wait and hold times in timestamp counter ticks. */
+	uint64_t wait_time;
+	uint64_t hold_time;
+
+	/* Wait and hold time log2 histograms. */
+	uint64_t wait_hist[MM_LOCK_STAT_HIST];
+	uint64_t hold_hist[MM_LOCK_STAT_HIST];
 };
 
 /* Collection of statistics entries for a lock for all threads. */
@@ -80,11 +95,68 @@ struct mm_lock_stat_info
 
 	/* Additional identification information. */
 	const char *moreinfo;
+
+	/* The time the lock was acquired by its current owner. */
+	uint64_t lock_time;
+};
+
+/* Statistics for a lock summed up for all threads. */
+struct mm_lock_stat_summary
+{
+	const char *location;
+	const char *moreinfo;
+	struct mm_lock_stat stat;
 };
 
 struct mm_lock_stat *mm_lock_getstat(struct mm_lock_stat_info *info)
 	__attribute__((nonnull(1)));
 
+size_t mm_lock_stat_top(struct mm_lock_stat_summary *top, size_t n)
+	__attribute__((nonnull(1)));
+
+static inline uint32_t
+mm_lock_stat_bucket(uint64_t time)
+{
+	if (time == 0)
+		return 0;
+	uint32_t bucket = 64 - mm_clz(time);
+	if (bucket >= MM_LOCK_STAT_HIST)
+		bucket = MM_LOCK_STAT_HIST - 1;
+	return bucket;
+}
+
+static inline void
+mm_lock_record_fail(struct mm_lock_stat_info *info)
+{
+	struct mm_lock_stat *stat = mm_lock_getstat(info);
+	stat->fail_count++;
+}
+
+static inline void
+mm_lock_record_lock(struct mm_lock_stat_info *info, uint64_t start, uint32_t fail)
+{
+	uint64_t time = mm_cpu_tsc();
+	uint64_t wait = time - start;
+
+	struct mm_lock_stat *stat = mm_lock_getstat(info);
+	stat->fail_count += fail;
+	stat->lock_count++;
+	stat->wait_time += wait;
+	stat->wait_hist[mm_lock_stat_bucket(wait)]++;
+
+	info->lock_time = time;
+}
+
+static inline void
+mm_lock_record_unlock(struct mm_lock_stat_info *info)
+{
+	uint64_t hold = mm_cpu_tsc() - info->lock_time;
+
+	struct mm_lock_stat *stat = mm_lock_getstat(info);
+	stat->hold_time += hold;
+	stat->hold_hist[mm_lock_stat_bucket(hold)]++;
+}
+
 #endif
 
 /**********************************************************************
@@ -113,11 +185,10 @@ mm_thread_trylock(mm_thread_lock_t *lock)
 	bool fail = mm_lock_acquire(&lock->lock);
 
 #if ENABLE_LOCK_STATS
-	struct mm_lock_stat *stat = mm_lock_getstat(&lock->stat);
 	if (fail)
-		stat->fail_count++;
+		mm_lock_record_fail(&lock->stat);
 	else
-		stat->lock_count++;
+		mm_lock_record_lock(&lock->stat, mm_cpu_tsc(), 0);
 #endif
 
 	return !fail;
@@ -127,6 +198,7 @@ static inline void
 mm_thread_lock(mm_thread_lock_t *lock)
 {
 #if ENABLE_LOCK_STATS
+	uint64_t start = mm_cpu_tsc();
 	uint32_t fail = 0;
 #endif
 	uint32_t backoff = 0;
@@ -141,15 +213,16 @@ mm_thread_lock(mm_thread_lock_t *lock)
 	}
 
 #if ENABLE_LOCK_STATS
-	struct mm_lock_stat *stat = mm_lock_getstat(&lock->stat);
-	stat->fail_count += fail;
-	stat->lock_count++;
+	mm_lock_record_lock(&lock->stat, start, fail);
 #endif
 }
 
 static inline void
 mm_thread_unlock(mm_thread_lock_t *lock)
 {
+#if ENABLE_LOCK_STATS
+	mm_lock_record_unlock(&lock->stat);
+#endif
 	mm_lock_release(&lock->lock);
 }
 
@@ -159,6 +232,211 @@ mm_thread_is_locked(mm_thread_lock_t *lock)
 	return mm_lock_is_acquired(&lock->lock);
 }
 
+/**********************************************************************
+ * Ticket Spin Locks (with optional statistics).
+ **********************************************************************/
+
+/*
+ * Ticket locks grant the lock in the FIFO order so they are fair under
+ * heavy contention. Waiting threads never yield as that might let a
+ * thread with a later ticket spin on the same core forever.
+ */
+
+/* The spin count per waiter ahead in the queue. */
+#define MM_TICKET_LOCK_BACKOFF	64
+
+#if ENABLE_LOCK_STATS
+# define MM_TICKET_LOCK_INIT	{ .head = 0, .tail = 0, .stat = MM_LOCK_STAT_INIT }
+#else
+# define MM_TICKET_LOCK_INIT	{ .head = 0, .tail = 0 }
+#endif
+
+typedef struct
+{
+	/* The ticket that currently owns the lock. */
+	mm_atomic_uint16_t head;
+	/* The next ticket to be taken. */
+	mm_atomic_uint16_t tail;
+
+#if ENABLE_LOCK_STATS
+	struct mm_lock_stat_info stat;
+#endif
+
+} mm_ticket_lock_t;
+
+static inline bool
+mm_ticket_trylock(mm_ticket_lock_t *lock)
+{
+	uint16_t head = mm_memory_load(lock->head);
+	uint16_t tail = mm_atomic_uint16_cas(&lock->tail, head, head + 1);
+	bool fail = (tail != head);
+
+#if ENABLE_LOCK_STATS
+	if (fail)
+		mm_lock_record_fail(&lock->stat);
+	else
+		mm_lock_record_lock(&lock->stat, mm_cpu_tsc(), 0);
+#endif
+
+	return !fail;
+}
+
+static inline void
+mm_ticket_lock(mm_ticket_lock_t *lock)
+{
+#if ENABLE_LOCK_STATS
+	uint64_t start = mm_cpu_tsc();
+	uint32_t fail = 0;
+#endif
+	uint16_t ticket = mm_atomic_uint16_fetch_and_add(&lock->tail, 1);
+
+	for (;;) {
+		uint16_t head = mm_memory_load(lock->head);
+		if (head == ticket)
+			break;
+#if ENABLE_LOCK_STATS
+		++fail;
+#endif
+		// Wait proportionally to the number of threads ahead.
+		uint16_t ahead = ticket - head;
+		mm_backoff_fixed(ahead * MM_TICKET_LOCK_BACKOFF);
+	}
+	mm_memory_load_fence();
+
+#if ENABLE_LOCK_STATS
+	mm_lock_record_lock(&lock->stat, start, fail);
+#endif
+}
+
+static inline void
+mm_ticket_unlock(mm_ticket_lock_t *lock)
+{
+#if ENABLE_LOCK_STATS
+	mm_lock_record_unlock(&lock->stat);
+#endif
+	uint16_t head = mm_memory_load(lock->head);
+	mm_memory_store_fence();
+	mm_memory_store(lock->head, (uint16_t) (head + 1));
+}
+
+static inline bool
+mm_ticket_is_locked(mm_ticket_lock_t *lock)
+{
+	uint16_t head = mm_memory_load(lock->head);
+	uint16_t tail = mm_memory_load(lock->tail);
+	return head != tail;
+}
+
+/**********************************************************************
+ * MCS Queue Locks (with optional statistics).
+ **********************************************************************/
+
+/*
+ * MCS locks maintain an explicit queue of waiting threads. Each thread
+ * spins on a flag in its own queue node so there is no cache line
+ * bouncing while waiting. The queue node is supplied by the caller and
+ * must be kept intact until the lock is released. Usually it is just
+ * placed on the stack.
+ */
+
+#if ENABLE_LOCK_STATS
+# define MM_MCS_LOCK_INIT	{ .tail = NULL, .stat = MM_LOCK_STAT_INIT }
+#else
+# define MM_MCS_LOCK_INIT	{ .tail = NULL }
+#endif
+
+/* MCS lock queue node. */
+struct mm_mcs_node
+{
+	struct mm_mcs_node *next;
+	uint8_t locked;
+};
+
+typedef struct
+{
+	/* The last node in the queue. */
+	mm_atomic_ptr_t tail;
+
+#if ENABLE_LOCK_STATS
+	struct mm_lock_stat_info stat;
+#endif
+
+} mm_mcs_lock_t;
+
+static inline bool
+mm_mcs_trylock(mm_mcs_lock_t *lock, struct mm_mcs_node *node)
+{
+	node->next = NULL;
+	mm_memory_store_fence();
+	bool fail = (mm_atomic_ptr_cas(&lock->tail, NULL, node) != NULL);
+
+#if ENABLE_LOCK_STATS
+	if (fail)
+		mm_lock_record_fail(&lock->stat);
+	else
+		mm_lock_record_lock(&lock->stat, mm_cpu_tsc(), 0);
+#endif
+
+	return !fail;
+}
+
+static inline void
+mm_mcs_lock(mm_mcs_lock_t *lock, struct mm_mcs_node *node)
+{
+#if ENABLE_LOCK_STATS
+	uint64_t start = mm_cpu_tsc();
+	uint32_t fail = 0;
+#endif
+
+	node->next = NULL;
+	node->locked = 1;
+	mm_memory_store_fence();
+
+	struct mm_mcs_node *prev = mm_atomic_ptr_fetch_and_set(&lock->tail, node);
+	if (prev != NULL) {
+		// Link to the predecessor and wait for its hand-off.
+		mm_memory_store(prev->next, node);
+		while (mm_memory_load(node->locked)) {
+#if ENABLE_LOCK_STATS
+			++fail;
+#endif
+			mm_spin_pause();
+		}
+		mm_memory_load_fence();
+	}
+
+#if ENABLE_LOCK_STATS
+	mm_lock_record_lock(&lock->stat, start, fail);
+#endif
+}
+
+static inline void
+mm_mcs_unlock(mm_mcs_lock_t *lock, struct mm_mcs_node *node)
+{
+#if ENABLE_LOCK_STATS
+	mm_lock_record_unlock(&lock->stat);
+#endif
+	struct mm_mcs_node *next = mm_memory_load(node->next);
+	if (next == NULL) {
+		// There seems to be no successor so try to reset the queue.
+		if (mm_atomic_ptr_cas(&lock->tail, node, NULL) == node)
+			return;
+		// A successor is going to link itself soon.
+		while ((next = mm_memory_load(node->next)) == NULL)
+			mm_spin_pause();
+	}
+
+	// Hand the lock off to the successor.
+	mm_memory_store_fence();
+	mm_memory_store(next->locked, 0);
+}
+
+static inline bool
+mm_mcs_is_locked(mm_mcs_lock_t *lock)
+{
+	return mm_memory_load(lock->tail) != NULL;
+}
+
 /**********************************************************************
  * Lock statistics.
  **********************************************************************/
@@ -62,7 +62,7 @@ mm_buffer_segment_destroy(mm_arena_t arena, struct mm_buffer_segment *seg)
  * Buffer internal segments.
  **********************************************************************/
 
-#define MM_BUFFER_MIN_CHUNK_SIZE	(4 * 1024 - MM_CHUNK_OVERHEAD)
+#define MM_BUFFER_MIN_CHUNK_SIZE	MM_BUFFER_SEGMENT_SIZE
 #define MM_BUFFER_MAX_CHUNK_SIZE	(256 * 1024 - MM_CHUNK_OVERHEAD)
 
 static void
@@ -136,7 +136,7 @@ mm_buffer_ensure_next_in(struct mm_buffer *buf,
 {
 	if (seg->next == NULL) {
 		seg->next = mm_buffer_chunk_reserve(buf, desired_size);
-		buf->chunk_size += seg->size;
+		buf->chunk_size += seg->next->size;
 	}
 	return seg->next;
 }
@@ -430,3 +430,87 @@ mm_buffer_splice(struct mm_buffer *buf, char *data, size_t size,
 leave:
 	LEAVE();
 }
+
+/*
+ * Copy the outgoing data of segments spliced with the given release routine
+ * to the buffer's internal storage and release the spliced data right away.
+ * This lets the data owner reclaim it without waiting for the peer to read.
+ */
+void
+mm_buffer_unsplice(struct mm_buffer *buf, mm_buffer_release_t release)
+{
+	ENTER();
+
+	struct mm_buffer_segment *seg = buf->out_seg;
+	while (seg != NULL) {
+		if (seg->release == release) {
+			// Find the part of the segment not yet sent out.
+			size_t start = seg == buf->out_seg ? buf->out_off : 0;
+			size_t end = seg == buf->in_seg ? buf->in_off : seg->size;
+			if (start < end) {
+				size_t size = end - start;
+				struct mm_chunk *chunk = mm_chunk_create(buf->chunk_tag, size);
+				memcpy(chunk->data, seg->data + start, size);
+				(*seg->release)(seg->release_data);
+
+				buf->extra_size -= seg->size;
+				buf->chunk_size += mm_chunk_getsize(chunk);
+
+				seg->data = chunk->data;
+				seg->size = size;
+				seg->release = mm_buffer_chunk_release;
+				seg->release_data = (uintptr_t) chunk;
+				if (seg == buf->out_seg)
+					buf->out_off = 0;
+				if (seg == buf->in_seg)
+					buf->in_off = size;
+			}
+		}
+		if (seg == buf->in_seg)
+			break;
+		seg = seg->next;
+	}
+
+	LEAVE();
+}
+
+/* Get the size of the outgoing data. */
+size_t
+mm_buffer_getsize(struct mm_buffer *buf)
+{
+	ENTER();
+
+	size_t size = 0;
+
+	struct mm_buffer_cursor cur;
+	bool rc = mm_buffer_first_out(buf, &cur);
+	while (rc) {
+		size += cur.end - cur.ptr;
+		rc = mm_buffer_next_out(buf, &cur);
+	}
+
+	LEAVE();
+	return size;
+}
+
+/* Free all the memory of an empty buffer. */
+void
+mm_buffer_release(struct mm_buffer *buf)
+{
+	ENTER();
+
+	if (!mm_buffer_empty(buf))
+		goto leave;
+
+	mm_buffer_cleanup(buf);
+
+	buf->in_seg = NULL;
+	buf->in_off = 0;
+	buf->out_seg = NULL;
+	buf->out_off = 0;
+	buf->chunk_size = 0;
+	buf->extra_size = 0;
+
+leave:
+	LEAVE();
+}
@@ -42,6 +42,12 @@
  * across cores.
  */
 
+/*
+ * The standard segment size. Small buffer chunks are rounded up to this
+ * size so that the chunks could be recycled across all the buffers.
+ */
+#define MM_BUFFER_SEGMENT_SIZE	(4 * 1024 - MM_CHUNK_OVERHEAD)
+
 typedef void (*mm_buffer_release_t)(uintptr_t release_data);
 
 struct mm_buffer
@@ -115,6 +121,15 @@ void mm_buffer_splice(struct mm_buffer *buf, char *data, size_t size,
 		      mm_buffer_release_t release, uintptr_t release_data)
 	__attribute__((nonnull(1)));
 
+void mm_buffer_unsplice(struct mm_buffer *buf, mm_buffer_release_t release)
+	__attribute__((nonnull(1, 2)));
+
+size_t mm_buffer_getsize(struct mm_buffer *buf)
+	__attribute__((nonnull(1)));
+
+void mm_buffer_release(struct mm_buffer *buf)
+	__attribute__((nonnull(1)));
+
 /**********************************************************************
  * Buffer cursor.
  **********************************************************************/
@@ -0,0 +1,328 @@
+/*
+ * base/settings.c - MainMemory configuration settings.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "base/settings.h"
+#include "base/bitset.h"
+#include "base/log/error.h"
+#include "base/log/trace.h"
+#include "base/mem/alloc.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The initial configuration file buffer size.
+#define MM_SETTINGS_FILE_SIZE	1024
+
+struct mm_setting
+{
+	char *key;
+	char *value;
+};
+
+static struct mm_setting *mm_settings_table = NULL;
+static size_t mm_settings_count = 0;
+static size_t mm_settings_size = 0;
+
+/**********************************************************************
+ * Settings initialization and termination.
+ **********************************************************************/
+
+void
+mm_settings_init(void)
+{
+	ENTER();
+
+	mm_settings_table = NULL;
+	mm_settings_count = 0;
+	mm_settings_size = 0;
+
+	LEAVE();
+}
+
+void
+mm_settings_term(void)
+{
+	ENTER();
+
+	for (size_t i = 0; i < mm_settings_count; i++) {
+		mm_global_free(mm_settings_table[i].key);
+		mm_global_free(mm_settings_table[i].value);
+	}
+	mm_global_free(mm_settings_table);
+
+	mm_settings_table = NULL;
+	mm_settings_count = 0;
+	mm_settings_size = 0;
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Settings access.
+ **********************************************************************/
+
+static struct mm_setting *
+mm_settings_find(const char *key)
+{
+	for (size_t i = 0; i < mm_settings_count; i++) {
+		if (strcmp(mm_settings_table[i].key, key) == 0)
+			return &mm_settings_table[i];
+	}
+	return NULL;
+}
+
+void
+mm_settings_set(const char *key, const char *value, bool overwrite)
+{
+	ENTER();
+
+	struct mm_setting *setting = mm_settings_find(key);
+	if (setting != NULL) {
+		if (overwrite) {
+			mm_global_free(setting->value);
+			setting->value = mm_global_strdup(value);
+		}
+		goto leave;
+	}
+
+	if (mm_settings_count == mm_settings_size) {
+		mm_settings_size = mm_settings_size ? mm_settings_size * 2 : 16;
+		mm_settings_table = mm_global_realloc(mm_settings_table,
+						      mm_settings_size * sizeof(struct mm_setting));
+	}
+
+	setting = &mm_settings_table[mm_settings_count++];
+	setting->key = mm_global_strdup(key);
+	setting->value = mm_global_strdup(value);
+
+leave:
+	LEAVE();
+}
+
+const char *
+mm_settings_get(const char *key, const char *def)
+{
+	struct mm_setting *setting = mm_settings_find(key);
+	if (setting == NULL)
+		return def;
+	return setting->value;
+}
+
+uint32_t
+mm_settings_get_uint32(const char *key, uint32_t def)
+{
+	const char *value = mm_settings_get(key, NULL);
+	if (value == NULL)
+		return def;
+
+	char *end;
+	errno = 0;
+	unsigned long n = strtoul(value, &end, 0);
+	if (errno || end == value || *end != 0 || n != (uint32_t) n)
+		mm_fatal(0, "invalid '%s' setting: '%s'", key, value);
+
+	return n;
+}
+
+size_t
+mm_settings_get_size(const char *key, size_t def)
+{
+	const char *value = mm_settings_get(key, NULL);
+	if (value == NULL)
+		return def;
+
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(value, &end, 0);
+	if (errno || end == value)
+		goto invalid;
+
+	unsigned shift = 0;
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	}
+	if (*end != 0)
+		goto invalid;
+	if (((n << shift) >> shift) != n || (size_t) (n << shift) != (n << shift))
+		goto invalid;
+
+	return n << shift;
+
+invalid:
+	mm_fatal(0, "invalid '%s' setting: '%s'", key, value);
+}
+
+bool
+mm_settings_get_cores(const char *key, struct mm_bitset *set)
+{
+	const char *value = mm_settings_get(key, NULL);
+	if (value == NULL)
+		return false;
+
+	mm_bitset_clear_all(set);
+
+	const char *s = value;
+	while (*s) {
+		char *end;
+		unsigned long first = strtoul(s, &end, 10);
+		if (end == s)
+			goto invalid;
+		unsigned long last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 10);
+			if (end == s || last < first)
+				goto invalid;
+		}
+
+		for (unsigned long core = first; core <= last; core++) {
+			if (core < mm_bitset_size(set))
+				mm_bitset_set(set, core);
+			else
+				mm_warning(0, "'%s' setting: no core %lu", key, core);
+		}
+
+		if (*end == ',')
+			end++;
+		else if (*end != 0)
+			goto invalid;
+		s = end;
+	}
+
+	return true;
+
+invalid:
+	mm_fatal(0, "invalid '%s' setting: '%s'", key, value);
+}
+
+/**********************************************************************
+ * Configuration file loading.
+ **********************************************************************/
+
+static char *
+mm_settings_trim(char *s)
+{
+	while (isspace((unsigned char) *s))
+		s++;
+	char *e = s + strlen(s);
+	while (e > s && isspace((unsigned char) *(e - 1)))
+		e--;
+	*e = 0;
+	return s;
+}
+
+static char *
+mm_settings_read(const char *path)
+{
+	// Use plain system calls as stdio would allocate memory with
+	// the overridden libc malloc.
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		mm_fatal(errno, "failed to open configuration file '%s'", path);
+
+	size_t size = 0;
+	size_t capacity = MM_SETTINGS_FILE_SIZE;
+	char *data = mm_global_alloc(capacity);
+	for (;;) {
+		if (size + 1 == capacity) {
+			capacity *= 2;
+			data = mm_global_realloc(data, capacity);
+		}
+
+		ssize_t n = read(fd, data + size, capacity - size - 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			mm_fatal(errno, "failed to read configuration file '%s'", path);
+		}
+		if (n == 0)
+			break;
+		size += n;
+	}
+	data[size] = 0;
+
+	close(fd);
+	return data;
+}
+
+void
+mm_settings_load(const char *path, bool (*check)(const char *key))
+{
+	ENTER();
+
+	char *data = mm_settings_read(path);
+
+	int lineno = 0;
+	char *next = data;
+	while (*next) {
+		char *line = next;
+		lineno++;
+
+		char *nl = strchr(line, '\n');
+		if (nl != NULL) {
+			*nl = 0;
+			next = nl + 1;
+		} else {
+			next = line + strlen(line);
+		}
+
+		// Strip comments.
+		char *hash = strchr(line, '#');
+		if (hash != NULL)
+			*hash = 0;
+
+		char *key = mm_settings_trim(line);
+		if (*key == 0)
+			continue;
+
+		char *eq = strchr(key, '=');
+		if (eq == NULL)
+			mm_fatal(0, "%s:%d: missing '='", path, lineno);
+		*eq = 0;
+
+		key = mm_settings_trim(key);
+		char *value = mm_settings_trim(eq + 1);
+		if (*key == 0)
+			mm_fatal(0, "%s:%d: missing setting name", path, lineno);
+		if (check != NULL && !check(key))
+			mm_fatal(0, "%s:%d: unknown setting '%s'", path, lineno, key);
+
+		mm_settings_set(key, value, false);
+	}
+
+	mm_global_free(data);
+
+	LEAVE();
+}
@@ -0,0 +1,65 @@
+/*
+ * base/settings.h - MainMemory configuration settings.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BASE_SETTINGS_H
+#define BASE_SETTINGS_H
+
+#include "common.h"
+
+/* Forward declaration. */
+struct mm_bitset;
+
+/*
+ * Settings are plain key-value string pairs. They come from the command
+ * line and from a configuration file with lines like
+ *
+ *	# comment
+ *	key = value
+ *
+ * A setting that is already there is not overridden by the file so the
+ * command line takes precedence.
+ */
+
+void mm_settings_init(void);
+void mm_settings_term(void);
+
+void mm_settings_set(const char *key, const char *value, bool overwrite)
+	__attribute__((nonnull(1, 2)));
+
+const char * mm_settings_get(const char *key, const char *def)
+	__attribute__((nonnull(1)));
+
+uint32_t mm_settings_get_uint32(const char *key, uint32_t def)
+	__attribute__((nonnull(1)));
+
+/* Get a size value with an optional k, m or g suffix. */
+size_t mm_settings_get_size(const char *key, size_t def)
+	__attribute__((nonnull(1)));
+
+/* Get a core list like "0-3,6". Returns false if the setting is absent.
+   The bitset has to be prepared by the caller. */
+bool mm_settings_get_cores(const char *key, struct mm_bitset *set)
+	__attribute__((nonnull(1, 2)));
+
+/* Load a configuration file. Every key in the file has to satisfy the
+   check routine if one is given. */
+void mm_settings_load(const char *path, bool (*check)(const char *key))
+	__attribute__((nonnull(1)));
+
+#endif /* BASE_SETTINGS_H */
@@ -0,0 +1,334 @@
+/*
+ * base/sys/topology.c - MainMemory CPU topology.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "base/sys/topology.h"
+#include "base/log/plain.h"
+#include "base/log/trace.h"
+#include "base/mem/alloc.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MM_TOPOLOGY_SYSFS	"/sys/devices/system/cpu"
+
+struct mm_topology mm_topology;
+
+/**********************************************************************
+ * Sysfs access.
+ **********************************************************************/
+
+// Read a small sysfs file. Plain system calls are used as stdio would
+// allocate memory with the overridden libc malloc.
+static bool
+mm_topology_read(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	ssize_t n = read(fd, buf, size - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+
+	buf[n] = 0;
+	return true;
+}
+
+static bool
+mm_topology_read_cpu_value(uint32_t cpu, const char *name, uint32_t *value)
+{
+	char path[128];
+	snprintf(path, sizeof path, MM_TOPOLOGY_SYSFS "/cpu%u/%s", cpu, name);
+
+	char buf[32];
+	if (!mm_topology_read(path, buf, sizeof buf))
+		return false;
+
+	char *end;
+	long n = strtol(buf, &end, 10);
+	if (end == buf || n < 0)
+		return false;
+
+	*value = n;
+	return true;
+}
+
+// Parse a CPU list like "0-3,8-11" calling the given routine for each
+// listed CPU. Stops and returns false if the routine does.
+static bool
+mm_topology_parse_list(const char *s, bool (*routine)(uint32_t cpu, void *data), void *data)
+{
+	while (*s && *s != '\n') {
+		char *end;
+		unsigned long first = strtoul(s, &end, 10);
+		if (end == s)
+			return false;
+		unsigned long last = first;
+		if (*end == '-') {
+			s = end + 1;
+			last = strtoul(s, &end, 10);
+			if (end == s || last < first)
+				return false;
+		}
+
+		for (unsigned long cpu = first; cpu <= last; cpu++) {
+			if (!routine(cpu, data))
+				return false;
+		}
+
+		if (*end == ',')
+			end++;
+		s = end;
+	}
+	return true;
+}
+
+/**********************************************************************
+ * Topology detection.
+ **********************************************************************/
+
+static bool
+mm_topology_add_cpu(uint32_t cpu, void *data __attribute__((unused)))
+{
+	struct mm_cpu *cpus = mm_topology.cpus;
+	uint32_t n = mm_topology.ncpus++;
+	cpus = mm_global_realloc(cpus, mm_topology.ncpus * sizeof(struct mm_cpu));
+
+	cpus[n].cpu = cpu;
+	cpus[n].package = 0;
+	cpus[n].core = cpu;
+	cpus[n].llc = 0;
+	cpus[n].thread = 0;
+
+	mm_topology.cpus = cpus;
+	return true;
+}
+
+static bool
+mm_topology_first_cpu(uint32_t cpu, void *data)
+{
+	*((uint32_t *) data) = cpu;
+	return false;
+}
+
+static bool
+mm_topology_count_sibling(uint32_t cpu, void *data)
+{
+	struct mm_cpu *self = data;
+	if (cpu >= self->cpu)
+		return false;
+	self->thread++;
+	return true;
+}
+
+static void
+mm_topology_detect_cpu(struct mm_cpu *cpu)
+{
+	char path[128];
+	char buf[256];
+
+	uint32_t package = 0, core_id = cpu->cpu;
+	mm_topology_read_cpu_value(cpu->cpu, "topology/physical_package_id", &package);
+	mm_topology_read_cpu_value(cpu->cpu, "topology/core_id", &core_id);
+	cpu->package = package;
+	cpu->core = core_id;
+
+	// The hardware thread number is the number of siblings that come
+	// before this CPU.
+	snprintf(path, sizeof path,
+		 MM_TOPOLOGY_SYSFS "/cpu%u/topology/thread_siblings_list", cpu->cpu);
+	cpu->thread = 0;
+	if (mm_topology_read(path, buf, sizeof buf))
+		mm_topology_parse_list(buf, mm_topology_count_sibling, cpu);
+
+	// The last-level cache domain is named after its first CPU. Take
+	// the package if there is no L3 cache.
+	snprintf(path, sizeof path,
+		 MM_TOPOLOGY_SYSFS "/cpu%u/cache/index3/shared_cpu_list", cpu->cpu);
+	uint32_t first = UINT32_MAX;
+	if (mm_topology_read(path, buf, sizeof buf))
+		mm_topology_parse_list(buf, mm_topology_first_cpu, &first);
+	cpu->llc = first != UINT32_MAX ? first : UINT32_MAX - package;
+}
+
+// Renumber a CPU attribute densely in the order of appearance and
+// return the number of distinct values.
+static uint32_t
+mm_topology_renumber(size_t offset)
+{
+	uint32_t n = mm_topology.ncpus;
+	uint32_t *orig = mm_global_alloc(n * sizeof(uint32_t));
+	for (uint32_t i = 0; i < n; i++)
+		orig[i] = *(uint32_t *) ((char *) &mm_topology.cpus[i] + offset);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t value = count;
+		for (uint32_t j = 0; j < i; j++) {
+			if (orig[j] == orig[i]) {
+				value = *(uint32_t *) ((char *) &mm_topology.cpus[j] + offset);
+				break;
+			}
+		}
+		if (value == count)
+			count++;
+		*(uint32_t *) ((char *) &mm_topology.cpus[i] + offset) = value;
+	}
+
+	mm_global_free(orig);
+	return count;
+}
+
+// The position of a physical core within its last-level cache domain.
+static uint32_t
+mm_topology_rank(const struct mm_cpu *cpu)
+{
+	uint32_t rank = 0;
+	for (uint32_t i = 0; i < mm_topology.ncpus; i++) {
+		const struct mm_cpu *other = &mm_topology.cpus[i];
+		if (other->thread == 0 && other->llc == cpu->llc && other->core < cpu->core)
+			rank++;
+	}
+	return rank;
+}
+
+static bool
+mm_topology_precedes(const struct mm_cpu *a, uint32_t a_rank,
+		     const struct mm_cpu *b, uint32_t b_rank)
+{
+	if (a->thread != b->thread)
+		return a->thread < b->thread;
+	if (a_rank != b_rank)
+		return a_rank < b_rank;
+	if (a->llc != b->llc)
+		return a->llc < b->llc;
+	return a->cpu < b->cpu;
+}
+
+static void
+mm_topology_order(void)
+{
+	uint32_t n = mm_topology.ncpus;
+	uint32_t *ranks = mm_global_alloc(n * sizeof(uint32_t));
+	for (uint32_t i = 0; i < n; i++)
+		ranks[i] = mm_topology_rank(&mm_topology.cpus[i]);
+
+	// Insertion sort, the number of CPUs is small.
+	for (uint32_t i = 1; i < n; i++) {
+		struct mm_cpu cpu = mm_topology.cpus[i];
+		uint32_t rank = ranks[i];
+		uint32_t j = i;
+		while (j > 0 && mm_topology_precedes(&cpu, rank, &mm_topology.cpus[j - 1], ranks[j - 1])) {
+			mm_topology.cpus[j] = mm_topology.cpus[j - 1];
+			ranks[j] = ranks[j - 1];
+			j--;
+		}
+		mm_topology.cpus[j] = cpu;
+		ranks[j] = rank;
+	}
+
+	mm_global_free(ranks);
+}
+
+void
+mm_topology_init(void)
+{
+	ENTER();
+
+	mm_topology.cpus = NULL;
+	mm_topology.ncpus = 0;
+
+	char buf[256];
+	mm_topology.detected = mm_topology_read(MM_TOPOLOGY_SYSFS "/online", buf, sizeof buf)
+		&& mm_topology_parse_list(buf, mm_topology_add_cpu, NULL)
+		&& mm_topology.ncpus > 0;
+
+	if (mm_topology.detected) {
+		for (uint32_t i = 0; i < mm_topology.ncpus; i++)
+			mm_topology_detect_cpu(&mm_topology.cpus[i]);
+	} else {
+		// Assume a flat topology.
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		if (n < 1)
+			n = 1;
+		mm_topology.ncpus = 0;
+		for (long i = 0; i < n; i++)
+			mm_topology_add_cpu(i, NULL);
+	}
+
+	// Make the physical cores unique across packages.
+	for (uint32_t i = 0; i < mm_topology.ncpus; i++) {
+		struct mm_cpu *cpu = &mm_topology.cpus[i];
+		cpu->core = (cpu->package << 16) + cpu->core;
+	}
+
+	mm_topology.npackages = mm_topology_renumber(offsetof(struct mm_cpu, package));
+	mm_topology.ncores = mm_topology_renumber(offsetof(struct mm_cpu, core));
+	mm_topology.nllcs = mm_topology_renumber(offsetof(struct mm_cpu, llc));
+
+	mm_topology.nthreads = 0;
+	for (uint32_t i = 0; i < mm_topology.ncpus; i++) {
+		if (mm_topology.nthreads <= mm_topology.cpus[i].thread)
+			mm_topology.nthreads = mm_topology.cpus[i].thread + 1;
+	}
+
+	mm_topology_order();
+
+	LEAVE();
+}
+
+void
+mm_topology_term(void)
+{
+	ENTER();
+
+	mm_global_free(mm_topology.cpus);
+	mm_topology.cpus = NULL;
+	mm_topology.ncpus = 0;
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Topology report.
+ **********************************************************************/
+
+void
+mm_topology_report(uint32_t nplaces)
+{
+	ENTER();
+
+	mm_brief("CPU topology (%s): %u CPUs, %u packages, %u physical cores, "
+		 "%u last-level caches, %u threads per core",
+		 mm_topology.detected ? "detected" : "assumed",
+		 mm_topology.ncpus, mm_topology.npackages, mm_topology.ncores,
+		 mm_topology.nllcs, mm_topology.nthreads);
+
+	for (uint32_t i = 0; i < nplaces; i++) {
+		const struct mm_cpu *cpu = mm_topology_place(i);
+		mm_verbose("core %u: cpu %u, package %u, physical core %u, llc %u, thread %u%s",
+			   i, cpu->cpu, cpu->package, cpu->core, cpu->llc, cpu->thread,
+			   i < mm_topology.ncpus ? "" : " (shared)");
+	}
+
+	LEAVE();
+}
@@ -0,0 +1,83 @@
+/*
+ * base/sys/topology.h - MainMemory CPU topology.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BASE_SYS_TOPOLOGY_H
+#define BASE_SYS_TOPOLOGY_H
+
+#include "common.h"
+
+/*
+ * The online CPUs are put into a placement order that takes the first
+ * hardware thread of every physical core before any SMT sibling and that
+ * alternates between last-level cache domains. So the first n places in
+ * the order make a good set of CPUs to run n threads on.
+ */
+
+/* A CPU description. */
+struct mm_cpu
+{
+	/* The OS CPU number. */
+	uint32_t cpu;
+	/* The CPU package (socket). */
+	uint32_t package;
+	/* The physical core number unique across packages. */
+	uint32_t core;
+	/* The last-level cache domain. */
+	uint32_t llc;
+	/* The hardware thread number within the physical core. */
+	uint32_t thread;
+};
+
+struct mm_topology
+{
+	/* The online CPUs in the placement order. */
+	struct mm_cpu *cpus;
+	uint32_t ncpus;
+
+	uint32_t npackages;
+	uint32_t ncores;
+	uint32_t nllcs;
+	uint32_t nthreads;
+
+	/* The topology comes from the OS rather than guessed. */
+	bool detected;
+};
+
+extern struct mm_topology mm_topology;
+
+void mm_topology_init(void);
+void mm_topology_term(void);
+
+void mm_topology_report(uint32_t nplaces);
+
+static inline const struct mm_cpu *
+mm_topology_place(uint32_t index)
+{
+	return &mm_topology.cpus[index % mm_topology.ncpus];
+}
+
+/* Check if a place is the first hardware thread of its physical core
+   and this core is not used by any preceding place. */
+static inline bool
+mm_topology_is_primary(uint32_t index)
+{
+	return index < mm_topology.ncpus && mm_topology_place(index)->thread == 0;
+}
+
+#endif /* BASE_SYS_TOPOLOGY_H */
@@ -30,9 +30,12 @@
 #include "base/log/log.h"
 #include "base/log/plain.h"
 #include "base/log/trace.h"
+#include "base/mem/buffer.h"
 #include "base/mem/cdata.h"
 #include "base/mem/chunk.h"
 #include "base/mem/mem.h"
+#include "base/settings.h"
+#include "base/sys/topology.h"
 #include "base/thr/domain.h"
 #include "base/thr/thread.h"
 #include "base/util/exit.h"
@@ -290,6 +293,164 @@ mm_core_receive_tasks(struct mm_core *core)
 # define mm_core_receive_tasks(core) ((void) core)
 #endif
 
+/**********************************************************************
+ * Cross-core requests.
+ **********************************************************************/
+
+static void
+mm_core_execute_request(struct mm_request *request)
+{
+	request->result = (request->execute)((mm_value_t) request);
+}
+
+#if ENABLE_SMP
+
+// Create the request and response rings between the current core and
+// the target core.
+static struct mm_ring_spsc *
+mm_core_connect(struct mm_core *core, mm_core_t core_id)
+{
+	ENTER();
+
+	mm_core_t self_id = mm_core_selfid();
+	struct mm_ring_spsc *requests = mm_ring_spsc_create(MM_CORE_REQUEST_RING_SIZE, 0);
+	mm_core->responses[core_id] = mm_ring_spsc_create(MM_CORE_REQUEST_RING_SIZE, 0);
+
+	// Make the response ring visible before the request ring.
+	mm_memory_store_fence();
+	mm_memory_store(core->requests[self_id], requests);
+
+	LEAVE();
+	return requests;
+}
+
+static void
+mm_core_receive_responses_from(struct mm_core *core, mm_core_t core_id)
+{
+	struct mm_ring_spsc *ring = core->responses[core_id];
+	if (ring == NULL)
+		return;
+
+	struct mm_request *request;
+	bool received = false;
+	while (mm_ring_spsc_get(ring, (void **) &request)) {
+		ASSERT(core->nrequests[core_id]);
+		core->nrequests[core_id]--;
+		(request->complete)(request);
+		received = true;
+	}
+
+	// Let the tasks waiting for a free request slot check again.
+	if (received) {
+		struct mm_list *link = &core->request_waiters;
+		while ((link = link->next) != &core->request_waiters) {
+			struct mm_task *task = containerof(link, struct mm_task, wait_queue);
+			mm_task_run(task);
+		}
+	}
+}
+
+static void
+mm_core_receive_responses(struct mm_core *core)
+{
+	ENTER();
+
+	for (mm_core_t i = 0; i < mm_core_num; i++)
+		mm_core_receive_responses_from(core, i);
+
+	LEAVE();
+}
+
+static void
+mm_core_receive_requests(struct mm_core *core)
+{
+	ENTER();
+
+	mm_core_t self_id = mm_core_getid(core);
+	for (mm_core_t i = 0; i < mm_core_num; i++) {
+		struct mm_ring_spsc *ring = mm_memory_load(core->requests[i]);
+		if (ring == NULL)
+			continue;
+
+		// Handle the whole batch of pending requests and then let
+		// the requesting core know about it at once. The response
+		// ring cannot overflow as the requesting core never has more
+		// requests pending than the ring size.
+		struct mm_core *sender = &mm_core_set[i];
+		struct mm_ring_spsc *responses = sender->responses[self_id];
+		struct mm_request *request;
+		bool received = false;
+		while (mm_ring_spsc_get(ring, (void **) &request)) {
+			mm_core_execute_request(request);
+			if (!mm_ring_spsc_put(responses, request))
+				ABORT();
+			received = true;
+		}
+
+		if (received)
+			mm_listener_notify(&sender->listener, &mm_core_dispatch);
+	}
+
+	LEAVE();
+}
+
+#else
+# define mm_core_receive_responses(core) ((void) core)
+# define mm_core_receive_requests(core) ((void) core)
+#endif
+
+void
+mm_core_request(mm_core_t core_id, struct mm_request *request)
+{
+	ENTER();
+
+#if ENABLE_SMP
+	// Handle the request directly if on the same core.
+	struct mm_core *core = mm_core_getptr(core_id);
+	if (core == mm_core) {
+		mm_core_execute_request(request);
+		(request->complete)(request);
+		goto leave;
+	}
+
+	struct mm_ring_spsc *ring = core->requests[mm_core_selfid()];
+	if (unlikely(ring == NULL))
+		ring = mm_core_connect(core, core_id);
+
+	// Wait for responses if there are too many requests in flight.
+	while (mm_core->nrequests[core_id] == MM_CORE_REQUEST_RING_SIZE) {
+		mm_core_receive_responses_from(mm_core, core_id);
+		if (mm_core->nrequests[core_id] < MM_CORE_REQUEST_RING_SIZE)
+			break;
+
+		mm_listener_notify(&core->listener, &mm_core_dispatch);
+
+		// Block until the dealer receives some responses.
+		struct mm_task *task = mm_task_self();
+		mm_list_append(&mm_core->request_waiters, &task->wait_queue);
+		mm_task_block();
+		mm_list_delete(&task->wait_queue);
+	}
+
+	// Put the request to the target core ring. There is no need for
+	// locking as other tasks of this core cannot run concurrently.
+	mm_core->nrequests[core_id]++;
+	if (!mm_ring_spsc_put(ring, request))
+		ABORT();
+
+	// Wakeup the target core if it is asleep.
+	mm_listener_notify(&core->listener, &mm_core_dispatch);
+
+leave:
+#else
+	(void) core_id;
+	mm_core_execute_request(request);
+	(request->complete)(request);
+#endif
+
+	LEAVE();
+}
+
 /**********************************************************************
  * Chunk allocation and reclamation.
  **********************************************************************/
@@ -309,10 +470,52 @@ mm_core_chunk_select(void)
 	return tag;
 }
 
+// Check to see if a chunk has the standard buffer segment size. The
+// allocator might give a little bit more memory than requested.
+static inline bool
+mm_core_chunk_is_standard(struct mm_chunk *chunk)
+{
+	size_t size = mm_chunk_getsize(chunk);
+	return (size >= MM_BUFFER_SEGMENT_SIZE
+		&& size < MM_BUFFER_SEGMENT_SIZE + MM_CHUNK_OVERHEAD);
+}
+
+// Free a chunk or keep it for reuse if it has the standard size.
+static void
+mm_core_chunk_reclaim(struct mm_core *core, struct mm_chunk *chunk)
+{
+	if (core->chunk_cache_size < MM_CORE_CHUNK_CACHE_SIZE
+	    && mm_core_chunk_is_standard(chunk)) {
+		mm_link_insert(&core->chunk_cache, &chunk->base.link);
+		core->chunk_cache_size++;
+	} else {
+		mm_local_free(chunk);
+	}
+}
+
+static void
+mm_core_chunk_cleanup(struct mm_core *core)
+{
+	while (!mm_link_empty(&core->chunk_cache)) {
+		struct mm_link *link = mm_link_delete_head(&core->chunk_cache);
+		mm_local_free(containerof(link, struct mm_chunk, base.link));
+	}
+	core->chunk_cache_size = 0;
+}
+
 void *
 mm_core_chunk_alloc(mm_chunk_t tag __attribute__((unused)), size_t size)
 {
 	ASSERT(tag == mm_core_selfid());
+
+	// Reuse a cached chunk if possible.
+	struct mm_core *core = mm_core_self();
+	if (size == MM_BUFFER_SEGMENT_SIZE + sizeof(struct mm_chunk)
+	    && !mm_link_empty(&core->chunk_cache)) {
+		core->chunk_cache_size--;
+		return mm_link_delete_head(&core->chunk_cache);
+	}
+
 	return mm_local_alloc(size);
 }
 
@@ -321,7 +524,7 @@ mm_core_chunk_free(mm_chunk_t tag, void *chunk)
 {
 	mm_core_t core = mm_core_selfid();
 	if (core == tag) {
-		mm_local_free(chunk);
+		mm_core_chunk_reclaim(mm_core_self(), chunk);
 	} else {
 		ASSERT(!MM_CHUNK_IS_ARENA_TAG(tag));
 
@@ -355,7 +558,7 @@ mm_core_destroy_chunks(struct mm_core *core)
 	void *chunk;
 	while (mm_ring_spsc_get(&core->chunks, &chunk)) {
 		ASSERT(mm_chunk_gettag((struct mm_chunk *) chunk) == mm_core_selfid());
-		mm_local_free(chunk);
+		mm_core_chunk_reclaim(core, chunk);
 	}
 
 	LEAVE();
@@ -520,6 +723,8 @@ mm_core_deal(struct mm_core *core)
 	mm_core_destroy_chunks(core);
 	mm_core_receive_tasks(core);
 	mm_core_receive_work(core);
+	mm_core_receive_requests(core);
+	mm_core_receive_responses(core);
 
 	// Run the pending tasks.
 	mm_task_yield();
@@ -779,6 +984,9 @@ mm_core_init_single(struct mm_core *core, uint32_t nworkers_max)
 
 	mm_wait_cache_prepare(&core->wait_cache);
 
+	mm_link_init(&core->chunk_cache);
+	core->chunk_cache_size = 0;
+
 	core->nwork = 0;
 	core->nidle = 0;
 	core->nworkers = 0;
@@ -794,6 +1002,11 @@ mm_core_init_single(struct mm_core *core, uint32_t nworkers_max)
 	mm_ring_spsc_prepare(&core->inbox, MM_CORE_INBOX_RING_SIZE, MM_RING_LOCKED_PUT);
 	mm_ring_spsc_prepare(&core->chunks, MM_CORE_CHUNK_RING_SIZE, MM_RING_LOCKED_PUT);
 
+	core->requests = mm_global_calloc(mm_core_num, sizeof(struct mm_ring_spsc *));
+	core->responses = mm_global_calloc(mm_core_num, sizeof(struct mm_ring_spsc *));
+	core->nrequests = mm_global_calloc(mm_core_num, sizeof(uint32_t));
+	mm_list_init(&core->request_waiters);
+
 	// Create the core bootstrap task.
 	struct mm_task_attr attr;
 	mm_task_attr_init(&attr);
@@ -826,6 +1039,22 @@ mm_core_term_inbox(struct mm_core *core)
 		mm_work_destroy_low(core_id, work);
 }
 
+static void
+mm_core_term_requests(struct mm_core *core)
+{
+	// Every ring is referenced by a single core as either a request
+	// or a response ring.
+	for (mm_core_t i = 0; i < mm_core_num; i++) {
+		if (core->requests[i] != NULL)
+			mm_global_free(core->requests[i]);
+		if (core->responses[i] != NULL)
+			mm_global_free(core->responses[i]);
+	}
+	mm_global_free(core->requests);
+	mm_global_free(core->responses);
+	mm_global_free(core->nrequests);
+}
+
 static void
 mm_core_term_single(struct mm_core *core)
 {
@@ -833,10 +1062,12 @@ mm_core_term_single(struct mm_core *core)
 
 	mm_core_term_work(core);
 	mm_core_term_inbox(core);
+	mm_core_term_requests(core);
 
 	mm_listener_cleanup(&core->listener);
 
 	mm_wait_cache_cleanup(&core->wait_cache);
+	mm_core_chunk_cleanup(core);
 
 	mm_task_destroy(core->boot);
 
@@ -906,14 +1137,27 @@ mm_core_init(void)
 	ENTER();
 	ASSERT(mm_core_num == 0);
 
-	// Find the number of CPU cores.
+	// Find the number of CPU cores unless it is configured.
+#if ENABLE_SMP
+	uint32_t ncores = mm_settings_get_uint32("cores", 0);
+	if (ncores >= MM_CORE_SELF)
+		mm_fatal(0, "too many cores: %u", ncores);
+	if (ncores == 0)
+		ncores = mm_core_get_ncpu();
+	mm_core_num = ncores;
+#else
 	mm_core_num = mm_core_get_ncpu();
+#endif
 	ASSERT(mm_core_num > 0);
 	if (mm_core_num == 1)
 		mm_brief("Running on 1 core.");
 	else
 		mm_brief("Running on %d cores.", mm_core_num);
 
+	// Find out how to place the cores on the CPUs.
+	mm_topology_init();
+	mm_topology_report(mm_core_num);
+
 	mm_memory_init(mm_core_chunk_select,
 		       mm_core_chunk_alloc,
 		       mm_core_chunk_free);
@@ -959,6 +1203,7 @@ mm_core_term(void)
 	mm_global_free(mm_core_set);
 
 	mm_domain_cleanup(&mm_core_domain);
+	mm_topology_term();
 
 	mm_core_free_hooks();
 
@@ -1021,7 +1266,7 @@ mm_core_start(void)
 		mm_domain_setstack(&mm_core_domain, i,
 				   (char *) core->boot->stack_base + MM_PAGE_SIZE,
 				   core->boot->stack_size - MM_PAGE_SIZE);
-		mm_domain_setcputag(&mm_core_domain, i, i);
+		mm_domain_setcputag(&mm_core_domain, i, mm_topology_place(i)->cpu);
 	}
 
 	mm_domain_start(&mm_core_domain, mm_core_boot);
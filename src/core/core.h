@@ -45,6 +45,21 @@ struct mm_work;
 #define MM_CORE_SCHED_RING_SIZE		(1024)
 #define MM_CORE_INBOX_RING_SIZE		(1024)
 #define MM_CORE_CHUNK_RING_SIZE		(1024)
+#define MM_CORE_CHUNK_CACHE_SIZE	(256)
+#define MM_CORE_REQUEST_RING_SIZE	(256)
+
+/*
+ * A request to run a routine on another core. The routine runs right in
+ * the dealer loop of the target core so it must never block. It gets the
+ * request itself as the argument. Then the completion routine runs in the
+ * dealer loop of the requesting core.
+ */
+struct mm_request
+{
+	mm_routine_t execute;
+	void (*complete)(struct mm_request *request);
+	mm_value_t result;
+};
 
 /* Virtual core state. */
 struct mm_core
@@ -75,6 +90,17 @@ struct mm_core
 	/* Cache of free wait entries. */
 	struct mm_wait_cache wait_cache;
 
+	/* Cache of free standard-size buffer chunks. */
+	struct mm_link chunk_cache;
+	uint32_t chunk_cache_size;
+
+	/* The response rings indexed by the responding core. */
+	struct mm_ring_spsc **responses;
+	/* The number of requests awaiting response from each core. */
+	uint32_t *nrequests;
+	/* The tasks blocked on too many requests in flight. */
+	struct mm_list request_waiters;
+
 	/* Time-related data. */
 	struct mm_time_manager time_manager;
 
@@ -109,6 +135,10 @@ struct mm_core
 	/* The memory chunks freed by other threads. */
 	MM_RING_SPSC(chunks, MM_CORE_CHUNK_RING_SIZE);
 
+	/* The request rings indexed by the requesting core. Each ring is
+	   created by its requesting core on the first use. */
+	struct mm_ring_spsc **requests;
+
 } __align_cacheline;
 
 void mm_core_init(void);
@@ -132,6 +162,9 @@ void mm_core_stop(void);
 
 void mm_core_post(mm_core_t core, mm_routine_t routine, mm_value_t routine_arg)
 	__attribute__((nonnull(2)));
+void mm_core_request(mm_core_t core_id, struct mm_request *request)
+	__attribute__((nonnull(2)));
+
 void mm_core_post_work(mm_core_t core_id, struct mm_work *work)
 	__attribute__((nonnull(2)));
 
@@ -28,6 +28,39 @@
 // The memory pool for futures.
 static struct mm_pool mm_future_pool;
 
+// A task waiting for a number of futures at once.
+struct mm_future_batch
+{
+	// The waiting task.
+	struct mm_task *task;
+
+	// The futures to wait for.
+	struct mm_future **futures;
+	uint32_t nfutures;
+	// The number of futures registered with the batch.
+	uint32_t nregistered;
+
+	// The number of finished futures to wait for.
+	uint32_t nwanted;
+	// The number of finished futures.
+	mm_atomic_uint32_t nready;
+};
+
+static mm_value_t
+mm_future_then_routine(mm_value_t arg)
+{
+	ENTER();
+
+	struct mm_future *future = (struct mm_future *) arg;
+	mm_value_t result = mm_memory_load(future->result);
+
+	// Run the continuation. It might destroy the future.
+	(future->then)(future, result, future->then_data);
+
+	LEAVE();
+	return 0;
+}
+
 static void
 mm_future_finish(struct mm_work *work, mm_value_t result)
 {
@@ -42,9 +75,31 @@ mm_future_finish(struct mm_work *work, mm_value_t result)
 	// Store the result.
 	mm_memory_store(future->result, result);
 
+	// Take the continuation if any.
+	mm_future_then_t then = future->then;
+	mm_core_t then_core = future->then_core;
+
+	// Account for the batch waiter if any.
+	struct mm_future_batch *batch = future->batch;
+	if (batch != NULL) {
+		future->batch = NULL;
+
+		// Read the batch data in advance as the waiter might
+		// leave as soon as the count is updated.
+		struct mm_task *task = batch->task;
+		uint32_t nwanted = batch->nwanted;
+		uint32_t nready = mm_atomic_uint32_fetch_and_add(&batch->nready, 1);
+		if (nready + 1 == nwanted)
+			mm_core_run_task(task);
+	}
+
 	// Wakeup all the waiters.
 	mm_waitset_broadcast(&future->waitset, &future->lock);
 
+	// Post the continuation back to the core that requested it.
+	if (then != NULL)
+		mm_core_post(then_core, mm_future_then_routine, (mm_value_t) future);
+
 	// Advertise the future task has finished. This must be the last
 	// access to the future structure performed by the task.
 	mm_memory_store_fence();
@@ -124,8 +179,13 @@ mm_future_create(mm_routine_t start, mm_value_t start_arg)
 	future->start_arg = start_arg;
 	future->result = MM_RESULT_DEFERRED;
 	future->cancel = false;
+	future->cancel_posted = false;
+	future->then = NULL;
+	future->then_data = 0;
+	future->then_core = MM_CORE_NONE;
 	future->lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
 	mm_waitset_prepare(&future->waitset);
+	future->batch = NULL;
 
 	LEAVE();
 	return future;
@@ -149,6 +209,11 @@ mm_future_destroy(struct mm_future *future)
 			count = mm_backoff(count);
 	}
 
+	// The same is true for a cancel request posted to another core.
+	uint32_t count = 0;
+	while (mm_memory_load(future->cancel_posted))
+		count = mm_backoff(count);
+
 	mm_waitset_cleanup(&future->waitset);
 
 	mm_pool_free(&mm_future_pool, future);
@@ -176,6 +241,37 @@ mm_future_start(struct mm_future *future, mm_core_t core)
 	return result;
 }
 
+#if ENABLE_SMP
+static mm_value_t
+mm_future_cancel_routine(mm_value_t arg)
+{
+	ENTER();
+
+	struct mm_future *future = (struct mm_future *) arg;
+
+	// Check if the future task is still running.
+	mm_task_lock(&future->lock);
+	struct mm_task *task = NULL;
+	if (mm_memory_load(future->result) == MM_RESULT_NOTREADY)
+		task = mm_memory_load(future->task);
+	mm_task_unlock(&future->lock);
+
+	// The task runs on this very core so it is safe to cancel it.
+	if (task != NULL) {
+		ASSERT(task->core == mm_core);
+		mm_task_cancel(task);
+	}
+
+	// Advertise the cancel request is done. This must be the last
+	// access to the future structure.
+	mm_memory_store_fence();
+	mm_memory_store(future->cancel_posted, false);
+
+	LEAVE();
+	return 0;
+}
+#endif
+
 void
 mm_future_cancel(struct mm_future *future)
 {
@@ -186,22 +282,58 @@ mm_future_cancel(struct mm_future *future)
 	// Make a synchronized check of the future status.
 	mm_task_lock(&future->lock);
 
+	struct mm_task *task = NULL;
 	mm_value_t result = mm_memory_load(future->result);
-	if (result == MM_RESULT_NOTREADY) {
-		struct mm_task *task = mm_memory_load(future->task);
-		if (task != NULL) {
-			// TODO: task cancel across cores
-			// TODO: catch and stop cancel in the future routine.
-#if 0
-			mm_task_cancel(task);
+	if (result == MM_RESULT_NOTREADY)
+		task = mm_memory_load(future->task);
+
+	mm_task_unlock(&future->lock);
+
+	if (task == NULL) {
+		// The future task is either not started yet and so it is
+		// going to notice the cancel flag or it has finished.
+	} else if (task->core == mm_core) {
+		// The future task runs on this core so it cannot finish
+		// before it is canceled here.
+		mm_task_cancel(task);
+	} else {
+#if ENABLE_SMP
+		// Forward the cancel request to the future task core
+		// unless there already is one on the way.
+		if (mm_atomic_uint8_cas(&future->cancel_posted, false, true) == false)
+			mm_core_post(mm_core_getid(task->core),
+				     mm_future_cancel_routine,
+				     (mm_value_t) future);
 #else
-			mm_warning(0, "running future cancellation is not implemented");
+		ABORT();
 #endif
-		}
 	}
 
+	LEAVE();
+}
+
+void
+mm_future_then(struct mm_future *future, mm_future_then_t routine, mm_value_t data)
+{
+	ENTER();
+	ASSERT(future->then == NULL);
+
+	// Make a synchronized check of the future status.
+	mm_task_lock(&future->lock);
+
+	future->then = routine;
+	future->then_data = data;
+	future->then_core = mm_core_selfid();
+
+	bool finished = mm_future_is_finished(future);
+
 	mm_task_unlock(&future->lock);
 
+	// If the future has already finished then the continuation is
+	// not going to be posted on completion so post it right now.
+	if (finished)
+		mm_core_post(MM_CORE_NONE, mm_future_then_routine, (mm_value_t) future);
+
 	LEAVE();
 }
 
@@ -285,3 +417,115 @@ mm_future_timedwait(struct mm_future *future, mm_timeout_t timeout)
 	LEAVE();
 	return result;
 }
+
+/**********************************************************************
+ * Batch future wait.
+ **********************************************************************/
+
+static void
+mm_future_batch_cleanup(uintptr_t arg)
+{
+	ENTER();
+
+	// Detach the batch from the futures that have not finished.
+	struct mm_future_batch *batch = (struct mm_future_batch *) arg;
+	for (uint32_t i = 0; i < batch->nregistered; i++) {
+		struct mm_future *future = batch->futures[i];
+		mm_task_lock(&future->lock);
+		if (future->batch == batch)
+			future->batch = NULL;
+		mm_task_unlock(&future->lock);
+	}
+
+	LEAVE();
+}
+
+static void
+mm_future_batch_wait(struct mm_future_batch *batch)
+{
+	ENTER();
+
+	// Ensure the batch is detached on task cancellation.
+	mm_task_cleanup_push(mm_future_batch_cleanup, batch);
+
+	for (uint32_t i = 0; i < batch->nfutures; i++) {
+		struct mm_future *future = batch->futures[i];
+
+		// Start the future if it has not been started already.
+		if (mm_memory_load(future->result) == MM_RESULT_DEFERRED)
+			mm_future_start(future, MM_CORE_NONE);
+
+		// Make a synchronized check of the future status.
+		mm_task_lock(&future->lock);
+		bool finished = mm_future_is_finished(future);
+		if (!finished) {
+			ASSERT(future->batch == NULL);
+			future->batch = batch;
+			batch->nregistered = i + 1;
+		}
+		mm_task_unlock(&future->lock);
+
+		if (finished) {
+			uint32_t nready = mm_atomic_uint32_fetch_and_add(&batch->nready, 1);
+			if (nready + 1 == batch->nwanted)
+				break;
+		}
+	}
+
+	// Wait for the required number of futures with a single wakeup.
+	while (mm_memory_load(batch->nready) < batch->nwanted) {
+		mm_task_testcancel();
+		mm_task_block();
+	}
+
+	// Unless all the futures have finished some of them might still
+	// refer to the batch.
+	mm_task_cleanup_pop(batch->nwanted < batch->nfutures);
+
+	LEAVE();
+}
+
+void
+mm_future_wait_all(struct mm_future **futures, uint32_t nfutures)
+{
+	ENTER();
+
+	struct mm_future_batch batch;
+	batch.task = mm_task_self();
+	batch.futures = futures;
+	batch.nfutures = nfutures;
+	batch.nregistered = 0;
+	batch.nwanted = nfutures;
+	batch.nready = 0;
+
+	mm_future_batch_wait(&batch);
+
+	LEAVE();
+}
+
+uint32_t
+mm_future_wait_any(struct mm_future **futures, uint32_t nfutures)
+{
+	ENTER();
+	ASSERT(nfutures != 0);
+
+	struct mm_future_batch batch;
+	batch.task = mm_task_self();
+	batch.futures = futures;
+	batch.nfutures = nfutures;
+	batch.nregistered = 0;
+	batch.nwanted = 1;
+	batch.nready = 0;
+
+	mm_future_batch_wait(&batch);
+
+	// Find a finished future.
+	uint32_t index = 0;
+	while (!mm_future_is_finished(futures[index])) {
+		index++;
+		ASSERT(index < nfutures);
+	}
+
+	LEAVE();
+	return index;
+}
@@ -26,6 +26,15 @@
 #include "core/wait.h"
 #include "core/work.h"
 
+/* Forward declarations. */
+struct mm_future;
+struct mm_future_batch;
+
+/* Future completion continuation. */
+typedef void (*mm_future_then_t)(struct mm_future *future,
+				 mm_value_t result,
+				 mm_value_t data);
+
 struct mm_future
 {
 	/* The future work item. */
@@ -43,12 +52,21 @@ struct mm_future
 
 	/* A cancel request has been made. */
 	mm_atomic_uint8_t cancel;
+	/* A cancel request has been posted to the future task core. */
+	mm_atomic_uint8_t cancel_posted;
+
+	/* The completion continuation and the core to run it on. */
+	mm_future_then_t then;
+	mm_value_t then_data;
+	mm_core_t then_core;
 
 	/* The internal state lock. */
 	mm_task_lock_t lock;
 
 	/* The tasks blocked waiting for the future. */
 	struct mm_waitset waitset;
+	/* The task blocked waiting for a batch of futures. */
+	struct mm_future_batch *batch;
 };
 
 void mm_future_init(void);
@@ -65,12 +83,31 @@ mm_value_t mm_future_start(struct mm_future *future, mm_core_t core)
 void mm_future_cancel(struct mm_future *future)
 	__attribute__((nonnull(1)));
 
+void mm_future_then(struct mm_future *future,
+		    mm_future_then_t routine, mm_value_t data)
+	__attribute__((nonnull(1, 2)));
+
 mm_value_t mm_future_wait(struct mm_future *future)
 	__attribute__((nonnull(1)));
 
 mm_value_t mm_future_timedwait(struct mm_future *future, mm_timeout_t timeout)
 	__attribute__((nonnull(1)));
 
+/* Wait until every future of the array finishes. Only one task at a
+   time may wait for a given future this way. */
+void mm_future_wait_all(struct mm_future **futures, uint32_t nfutures)
+	__attribute__((nonnull(1)));
+
+/* Wait until any future of the array finishes and return its index. */
+uint32_t mm_future_wait_any(struct mm_future **futures, uint32_t nfutures)
+	__attribute__((nonnull(1)));
+
+static inline mm_value_t
+mm_future_getresult(struct mm_future *future)
+{
+	return mm_memory_load(future->result);
+}
+
 static inline bool
 mm_future_is_started(struct mm_future *future)
 {
@@ -0,0 +1,294 @@
+/*
+ * core/lock.c - MainMemory task locks.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/lock.h"
+#include "core/core.h"
+#include "core/task.h"
+
+#include "base/log/trace.h"
+#include "base/thr/domain.h"
+
+#if ENABLE_SMP
+
+// The backoff count after which a contending task gets parked.
+#define MM_TASK_LOCK_SPIN	(0xff)
+
+// An entry for a parked task. It resides on the parked task stack.
+struct mm_task_lock_wait
+{
+	struct mm_link link;
+	struct mm_task *task;
+};
+
+// Check to see if the current task is allowed to park. The dealer task
+// must never block as it is the one that receives wakeup requests from
+// other cores. A combining task might run on behalf of other tasks so it
+// should not block either.
+static bool
+mm_task_lock_can_park(void)
+{
+	if (mm_core == NULL)
+		return false;
+
+	struct mm_task *task = mm_task_self();
+	if (task == mm_core->dealer)
+		return false;
+	if ((task->flags & MM_TASK_COMBINING) != 0)
+		return false;
+
+	return true;
+}
+
+// Park the current task on the lock. Returns true if the lock happens
+// to be acquired in the course of parking.
+static bool
+mm_task_lock_park(mm_task_lock_t *lock)
+{
+	ENTER();
+
+	struct mm_task_lock_wait wait = { .task = mm_task_self() };
+
+	// Add the task to the tail of the list of parked tasks.
+	mm_global_lock(&lock->waiters_lock);
+	struct mm_link *prev = &lock->waiters;
+	while (!mm_link_is_last(prev))
+		prev = prev->next;
+	mm_link_insert(prev, &wait.link);
+
+	// Set the waiters bit so that the lock owner takes the slow path
+	// on release. If the lock is released meanwhile then acquire it
+	// right away.
+	bool acquired;
+	uint8_t state = mm_memory_load(lock->state);
+	for (;;) {
+		uint8_t next;
+		if ((state & MM_TASK_LOCK_ACQUIRED) != 0)
+			next = state | MM_TASK_LOCK_WAITERS;
+		else
+			next = state | MM_TASK_LOCK_ACQUIRED;
+		uint8_t seen = mm_atomic_uint8_cas(&lock->state, state, next);
+		if (seen == state) {
+			acquired = (state & MM_TASK_LOCK_ACQUIRED) == 0;
+			break;
+		}
+		state = seen;
+	}
+	// A stale waiters bit left here is cleared by the next release.
+	if (acquired)
+		mm_link_delete_next(prev);
+	mm_global_unlock(&lock->waiters_lock);
+
+	if (!acquired) {
+		// Disable cancellation as the task must not leave with its
+		// wait entry still linked to the lock.
+		int cancelstate;
+		mm_task_setcancelstate(MM_TASK_CANCEL_DISABLE, &cancelstate);
+
+		// Wait until the lock owner wakes the task up.
+		mm_task_block();
+
+		// In case of a spurious wakeup the entry is still linked.
+		if (mm_memory_load(wait.task) != NULL) {
+			mm_global_lock(&lock->waiters_lock);
+			if (wait.task != NULL) {
+				prev = &lock->waiters;
+				while (prev->next != &wait.link)
+					prev = prev->next;
+				mm_link_delete_next(prev);
+			}
+			mm_global_unlock(&lock->waiters_lock);
+		}
+
+		// Restore cancellation.
+		mm_task_setcancelstate(cancelstate, NULL);
+	}
+
+	LEAVE();
+	return acquired;
+}
+
+void
+mm_task_lock_slow(mm_task_lock_t *lock)
+{
+	ENTER();
+
+	bool park = mm_task_lock_can_park();
+
+#if ENABLE_LOCK_STATS
+	uint64_t start = mm_cpu_tsc();
+	uint32_t fail = 0;
+#endif
+	uint32_t backoff = 0;
+
+	while (!mm_task_lock_acquire(lock)) {
+		if (park && backoff >= MM_TASK_LOCK_SPIN) {
+			if (mm_task_lock_park(lock))
+				break;
+			// Start spinning anew after a wakeup.
+			backoff = 0;
+			continue;
+		}
+
+		do {
+#if ENABLE_LOCK_STATS
+			++fail;
+#endif
+			backoff = mm_backoff(backoff);
+		} while (mm_task_is_locked(lock));
+	}
+
+#if ENABLE_LOCK_STATS
+	mm_lock_record_lock(&lock->stat, start, fail);
+#endif
+
+	LEAVE();
+}
+
+void
+mm_task_unlock_slow(mm_task_lock_t *lock)
+{
+	ENTER();
+
+	// Get the first parked task if any.
+	struct mm_task *task = NULL;
+	mm_global_lock(&lock->waiters_lock);
+	if (!mm_link_empty(&lock->waiters)) {
+		struct mm_link *link = mm_link_delete_head(&lock->waiters);
+		struct mm_task_lock_wait *wait = containerof(link, struct mm_task_lock_wait, link);
+		task = wait->task;
+		// Let the parked task know that its entry is unlinked.
+		mm_memory_store_fence();
+		mm_memory_store(wait->task, NULL);
+	}
+
+	// Release the lock. Nobody else changes the lock word while both
+	// the lock and the parked task list are held so a plain store is
+	// enough. Keep the waiters bit if there are more parked tasks.
+	uint8_t state = 0;
+	if (!mm_link_empty(&lock->waiters))
+		state = MM_TASK_LOCK_WAITERS;
+	mm_memory_store_fence();
+	mm_memory_store(lock->state, state);
+
+	mm_global_unlock(&lock->waiters_lock);
+
+	// Wake the task up. It will contend for the lock anew.
+	if (task != NULL)
+		mm_core_run_task(task);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Reader-writer task locks.
+ **********************************************************************/
+
+void
+mm_task_rwlock_prepare(mm_task_rwlock_t *lock, const char *name)
+{
+	ENTER();
+
+	lock->lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
+#if ENABLE_LOCK_STATS
+	lock->lock.stat.moreinfo = name;
+#endif
+	lock->writer = 0;
+
+	MM_CDATA_ALLOC(mm_domain_self(), name, lock->readers);
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		uint32_t *readers = MM_CDATA_DEREF(core, lock->readers);
+		*readers = 0;
+	}
+
+	LEAVE();
+}
+
+void
+mm_task_read_lock(mm_task_rwlock_t *lock)
+{
+	ENTER();
+
+	uint32_t *readers = MM_CDATA_DEREF(mm_core_selfid(), lock->readers);
+	for (;;) {
+		// Announce the reader. Only the current core updates its
+		// counter so there is no need for an atomic operation.
+		mm_memory_store(*readers, *readers + 1);
+
+		// Check to see if there is no writer. The fence pairs with
+		// the one in mm_task_write_lock().
+		mm_memory_strict_fence();
+		if (likely(mm_memory_load(lock->writer) == 0))
+			break;
+
+		// Step aside and wait for the writer to finish.
+		mm_memory_store(*readers, *readers - 1);
+		mm_task_lock(&lock->lock);
+		mm_task_unlock(&lock->lock);
+	}
+
+	LEAVE();
+}
+
+void
+mm_task_read_unlock(mm_task_rwlock_t *lock)
+{
+	ENTER();
+
+	uint32_t *readers = MM_CDATA_DEREF(mm_core_selfid(), lock->readers);
+	mm_memory_store_fence();
+	mm_memory_store(*readers, *readers - 1);
+
+	LEAVE();
+}
+
+void
+mm_task_write_lock(mm_task_rwlock_t *lock)
+{
+	ENTER();
+
+	// Exclude other writers.
+	mm_task_lock(&lock->lock);
+
+	// Stop new readers and wait for the current ones to leave.
+	mm_memory_store(lock->writer, 1);
+	mm_memory_strict_fence();
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		uint32_t *readers = MM_CDATA_DEREF(core, lock->readers);
+		uint32_t backoff = 0;
+		while (mm_memory_load(*readers) != 0)
+			backoff = mm_backoff(backoff);
+	}
+	mm_memory_load_fence();
+
+	LEAVE();
+}
+
+void
+mm_task_write_unlock(mm_task_rwlock_t *lock)
+{
+	ENTER();
+
+	mm_memory_store_fence();
+	mm_memory_store(lock->writer, 0);
+	mm_task_unlock(&lock->lock);
+
+	LEAVE();
+}
+
+#endif
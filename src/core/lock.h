@@ -20,10 +20,38 @@
 #ifndef CORE_LOCK_H
 #define CORE_LOCK_H
 
+#include "base/list.h"
 #include "base/lock.h"
+#include "base/mem/cdata.h"
+
+/*
+ * Task locks are spin locks that are aware of the task scheduler. A task
+ * that fails to acquire a lock spins for a short while. If the lock is
+ * still not available then the task is parked on the lock and the core
+ * is free to run other tasks. The parked task is woken up when the lock
+ * owner releases the lock.
+ *
+ * The lock word has a bit that tells if there are parked tasks. It is set
+ * only under the parked task list lock while the lock is acquired. So an
+ * uncontended release is a single compare-and-swap on the lock word.
+ */
 
 #if ENABLE_SMP
-# define MM_TASK_LOCK_INIT	{ .lock = MM_THREAD_LOCK_INIT }
+
+/* Lock word bits. */
+#define MM_TASK_LOCK_ACQUIRED	1
+#define MM_TASK_LOCK_WAITERS	2
+
+# if ENABLE_LOCK_STATS
+#  define MM_TASK_LOCK_INIT	{ .state = 0,			\
+				  .waiters_lock = MM_LOCK_INIT,	\
+				  .waiters = { NULL },		\
+				  .stat = MM_LOCK_STAT_INIT }
+# else
+#  define MM_TASK_LOCK_INIT	{ .state = 0,			\
+				  .waiters_lock = MM_LOCK_INIT,	\
+				  .waiters = { NULL } }
+# endif
 #else
 # define MM_TASK_LOCK_INIT	{ .lock = 0 }
 #endif
@@ -31,18 +59,55 @@
 typedef struct
 {
 #if ENABLE_SMP
-	mm_thread_lock_t lock;
+	/* The lock word. */
+	mm_atomic_uint8_t state;
+	/* The lock that protects the list of parked tasks. */
+	mm_lock_t waiters_lock;
+	/* The list of parked tasks. */
+	struct mm_link waiters;
+# if ENABLE_LOCK_STATS
+	struct mm_lock_stat_info stat;
+# endif
 #else
 	uint8_t lock;
 #endif
 
 } mm_task_lock_t;
 
+#if ENABLE_SMP
+
+void mm_task_lock_slow(mm_task_lock_t *lock)
+	__attribute__((nonnull(1)));
+void mm_task_unlock_slow(mm_task_lock_t *lock)
+	__attribute__((nonnull(1)));
+
+/* Make a single attempt to acquire the lock. Keeps the waiters bit. */
+static inline bool
+mm_task_lock_acquire(mm_task_lock_t *lock)
+{
+	uint8_t state = mm_memory_load(lock->state);
+	if ((state & MM_TASK_LOCK_ACQUIRED) != 0)
+		return false;
+	uint8_t next = state | MM_TASK_LOCK_ACQUIRED;
+	return mm_atomic_uint8_cas(&lock->state, state, next) == state;
+}
+
+#endif
+
 static inline bool
 mm_task_trylock(mm_task_lock_t *lock)
 {
 #if ENABLE_SMP
-	return mm_thread_trylock(&lock->lock);
+	bool acquired = mm_task_lock_acquire(lock);
+
+# if ENABLE_LOCK_STATS
+	if (acquired)
+		mm_lock_record_lock(&lock->stat, mm_cpu_tsc(), 0);
+	else
+		mm_lock_record_fail(&lock->stat);
+# endif
+
+	return acquired;
 #else
 	(void) lock;
 	return true;
@@ -53,7 +118,8 @@ static inline void
 mm_task_lock(mm_task_lock_t *lock)
 {
 #if ENABLE_SMP
-	mm_thread_lock(&lock->lock);
+	if (!mm_task_trylock(lock))
+		mm_task_lock_slow(lock);
 #else
 	(void) lock;
 #endif
@@ -63,7 +129,15 @@ static inline void
 mm_task_unlock(mm_task_lock_t *lock)
 {
 #if ENABLE_SMP
-	mm_thread_unlock(&lock->lock);
+# if ENABLE_LOCK_STATS
+	mm_lock_record_unlock(&lock->stat);
+# endif
+
+	// The release fails if the waiters bit is set. Then a parked
+	// task needs to be woken up.
+	uint8_t state = mm_atomic_uint8_cas(&lock->state, MM_TASK_LOCK_ACQUIRED, 0);
+	if (unlikely(state != MM_TASK_LOCK_ACQUIRED))
+		mm_task_unlock_slow(lock);
 #else
 	(void) lock;
 #endif
@@ -73,11 +147,86 @@ static inline bool
 mm_task_is_locked(mm_task_lock_t *lock)
 {
 #if ENABLE_SMP
-	return mm_thread_is_locked(&lock->lock);
+	return (mm_memory_load(lock->state) & MM_TASK_LOCK_ACQUIRED) != 0;
 #else
 	(void) lock;
 	return false;
 #endif
 }
 
+/**********************************************************************
+ * Reader-writer task locks.
+ **********************************************************************/
+
+/*
+ * Reader-writer task locks keep a separate reader counter for each core.
+ * A reader only touches the counter of its own core so readers running
+ * on different cores do not contend with each other. A writer raises a
+ * flag and waits until all the reader counters drop to zero. Readers that
+ * see the flag step aside and park on the writer lock so writers are
+ * preferred.
+ *
+ * A read-side critical section must never block or yield.
+ */
+
+typedef struct
+{
+#if ENABLE_SMP
+	/* The lock that serializes writers. */
+	mm_task_lock_t lock;
+	/* The flag that indicates an active writer. */
+	uint8_t writer;
+	/* Per-core reader counters. */
+	MM_CDATA(uint32_t, readers);
+#else
+	uint8_t lock;
+#endif
+
+} mm_task_rwlock_t;
+
+#if ENABLE_SMP
+
+void mm_task_rwlock_prepare(mm_task_rwlock_t *lock, const char *name)
+	__attribute__((nonnull(1, 2)));
+
+void mm_task_read_lock(mm_task_rwlock_t *lock)
+	__attribute__((nonnull(1)));
+void mm_task_read_unlock(mm_task_rwlock_t *lock)
+	__attribute__((nonnull(1)));
+
+void mm_task_write_lock(mm_task_rwlock_t *lock)
+	__attribute__((nonnull(1)));
+void mm_task_write_unlock(mm_task_rwlock_t *lock)
+	__attribute__((nonnull(1)));
+
+#else
+
+static inline void
+mm_task_rwlock_prepare(mm_task_rwlock_t *lock, const char *name __attribute__((unused)))
+{
+	lock->lock = 0;
+}
+
+static inline void
+mm_task_read_lock(mm_task_rwlock_t *lock __attribute__((unused)))
+{
+}
+
+static inline void
+mm_task_read_unlock(mm_task_rwlock_t *lock __attribute__((unused)))
+{
+}
+
+static inline void
+mm_task_write_lock(mm_task_rwlock_t *lock __attribute__((unused)))
+{
+}
+
+static inline void
+mm_task_write_unlock(mm_task_rwlock_t *lock __attribute__((unused)))
+{
+}
+
+#endif
+
 #endif /* CORE_LOCK_H */
@@ -0,0 +1,263 @@
+/*
+ * core/msgport.c - MainMemory zero-copy message ports.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "core/msgport.h"
+#include "core/core.h"
+#include "core/task.h"
+
+#include "base/bitops.h"
+#include "base/log/debug.h"
+#include "base/log/trace.h"
+#include "base/mem/alloc.h"
+#include "base/mem/chunk.h"
+
+/**********************************************************************
+ * Messages.
+ **********************************************************************/
+
+struct mm_msg *
+mm_msg_create(uint32_t size)
+{
+	ENTER();
+
+	// Use a chunk as it can be freed on any core.
+	struct mm_chunk *chunk = mm_chunk_create(mm_chunk_select(),
+						 sizeof(struct mm_msg) + size);
+	struct mm_msg *msg = (struct mm_msg *) chunk->data;
+	msg->size = size;
+
+	LEAVE();
+	return msg;
+}
+
+void
+mm_msg_destroy(struct mm_msg *msg)
+{
+	ENTER();
+
+	struct mm_chunk *chunk = containerof(msg, struct mm_chunk, data);
+	mm_chunk_destroy(chunk);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Message port creation and destruction.
+ **********************************************************************/
+
+struct mm_msgport *
+mm_msgport_create(struct mm_task *task, uint32_t size, bool multi_sender)
+{
+	ENTER();
+	ASSERT(size > 1);
+
+	// Round the ring size to a power of 2.
+	size = 1 << (8 * sizeof(uint32_t) - mm_clz(size - 1));
+
+	struct mm_msgport *port = mm_global_aligned_alloc(MM_CACHELINE,
+							  sizeof(struct mm_msgport));
+	if (multi_sender)
+		port->mpmc_ring = mm_ring_mpmc_create(size);
+	else
+		port->spsc_ring = mm_ring_spsc_create(size, 0);
+	port->multi_sender = multi_sender;
+	port->receiver_blocked = false;
+	port->task = task;
+	port->credits = size;
+	port->nblocked = 0;
+	port->lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
+	mm_waitset_prepare(&port->blocked_senders);
+
+	LEAVE();
+	return port;
+}
+
+void
+mm_msgport_destroy(struct mm_msgport *port)
+{
+	ENTER();
+	ASSERT(port->nblocked == 0);
+
+	// Destroy the messages that have not been received.
+	struct mm_msg *msg;
+	while (mm_msgport_receive(port, &msg, 1))
+		mm_msg_destroy(msg);
+
+	if (port->multi_sender)
+		mm_global_free(port->mpmc_ring);
+	else
+		mm_global_free(port->spsc_ring);
+	mm_waitset_cleanup(&port->blocked_senders);
+	mm_global_free(port);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Message sending.
+ **********************************************************************/
+
+static bool
+mm_msgport_take_credit(struct mm_msgport *port)
+{
+	uint32_t credits = mm_memory_load(port->credits);
+	while (credits != 0) {
+		uint32_t prev = mm_atomic_uint32_cas(&port->credits,
+						     credits, credits - 1);
+		if (prev == credits)
+			return true;
+		credits = prev;
+	}
+	return false;
+}
+
+static void
+mm_msgport_put(struct mm_msgport *port, struct mm_msg *msg)
+{
+	// The credit guarantees there is a free ring slot.
+	if (port->multi_sender)
+		mm_ring_mpmc_enqueue(port->mpmc_ring, (uintptr_t) msg);
+	else if (unlikely(!mm_ring_spsc_put(port->spsc_ring, msg)))
+		ABORT();
+
+	// Wake up the receiver if it is blocked. Only one of the senders
+	// that see the flag actually does this.
+	mm_memory_strict_fence();
+	if (mm_memory_load(port->receiver_blocked)
+	    && mm_atomic_uint8_fetch_and_set(&port->receiver_blocked, false))
+		mm_core_run_task(port->task);
+}
+
+bool
+mm_msgport_send(struct mm_msgport *port, struct mm_msg *msg)
+{
+	ENTER();
+	ASSERT(port->task != mm_task_self());
+
+	bool rc = mm_msgport_take_credit(port);
+	if (rc)
+		mm_msgport_put(port, msg);
+
+	LEAVE();
+	return rc;
+}
+
+void
+mm_msgport_send_blocking(struct mm_msgport *port, struct mm_msg *msg)
+{
+	ENTER();
+	ASSERT(port->task != mm_task_self());
+
+	while (!mm_msgport_take_credit(port)) {
+
+		// Check if the task has been canceled.
+		mm_task_testcancel();
+
+		mm_task_lock(&port->lock);
+
+		// Announce the sender is going to block and then check
+		// the credits again so the receiver either sees it or
+		// the sender sees the returned credits.
+		mm_atomic_uint32_inc(&port->nblocked);
+		if (mm_msgport_take_credit(port)) {
+			mm_atomic_uint32_dec(&port->nblocked);
+			mm_task_unlock(&port->lock);
+			break;
+		}
+
+		// Wait for the receiver to return some credits.
+		mm_waitset_wait(&port->blocked_senders, &port->lock);
+		mm_atomic_uint32_dec(&port->nblocked);
+	}
+
+	mm_msgport_put(port, msg);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Message receiving.
+ **********************************************************************/
+
+static void
+mm_msgport_return_credits(struct mm_msgport *port, uint32_t ncredits)
+{
+	// The atomic add also serves as a full fence for the check below.
+	mm_atomic_uint32_fetch_and_add(&port->credits, ncredits);
+
+	// Wake up the senders that ran out of credits.
+	if (mm_memory_load(port->nblocked) != 0) {
+		mm_task_lock(&port->lock);
+		mm_waitset_broadcast(&port->blocked_senders, &port->lock);
+	}
+}
+
+uint32_t
+mm_msgport_receive(struct mm_msgport *port, struct mm_msg **msgs, uint32_t nmsgs)
+{
+	ENTER();
+	ASSERT(port->task == mm_task_self());
+
+	uint32_t n = 0;
+	if (port->multi_sender) {
+		uintptr_t data;
+		while (n < nmsgs && mm_ring_relaxed_get(port->mpmc_ring, &data))
+			msgs[n++] = (struct mm_msg *) data;
+	} else {
+		void *data;
+		while (n < nmsgs && mm_ring_spsc_get(port->spsc_ring, &data))
+			msgs[n++] = (struct mm_msg *) data;
+	}
+
+	// Give back the credits for the whole batch at once.
+	if (n != 0)
+		mm_msgport_return_credits(port, n);
+
+	LEAVE();
+	return n;
+}
+
+uint32_t
+mm_msgport_receive_blocking(struct mm_msgport *port, struct mm_msg **msgs, uint32_t nmsgs)
+{
+	ENTER();
+	ASSERT(nmsgs != 0);
+
+	uint32_t n;
+	while ((n = mm_msgport_receive(port, msgs, nmsgs)) == 0) {
+
+		// Announce the receiver is going to block and then check
+		// the ring again so a sender either sees it or the receiver
+		// sees the sent message.
+		mm_memory_store(port->receiver_blocked, true);
+		mm_memory_strict_fence();
+
+		n = mm_msgport_receive(port, msgs, nmsgs);
+		if (n != 0) {
+			mm_memory_store(port->receiver_blocked, false);
+			break;
+		}
+
+		mm_task_block();
+		mm_task_testcancel();
+	}
+
+	LEAVE();
+	return n;
+}
@@ -0,0 +1,120 @@
+/*
+ * core/msgport.h - MainMemory zero-copy message ports.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CORE_MSGPORT_H
+#define CORE_MSGPORT_H
+
+#include "common.h"
+#include "arch/atomic.h"
+#include "base/lock.h"
+#include "base/ring.h"
+#include "core/wait.h"
+
+/* Forward declaration. */
+struct mm_task;
+
+/*
+ * Unlike the plain port that copies message words into its own buffer
+ * a message port passes pointers to separately allocated messages. The
+ * sender creates a message, fills it in place, and sends it. From then
+ * on the message belongs to the receiver that eventually destroys it.
+ *
+ * The messages go through a lock-free ring. A sender has to take a credit
+ * for every message. The port has as many credits as ring slots so the
+ * ring never overflows. The receiver gives the credits back for a whole
+ * batch of received messages at once. A sender that runs out of credits
+ * blocks until the receiver catches up.
+ */
+
+/* A variable-size message. */
+struct mm_msg
+{
+	/* The payload size. */
+	uint32_t size;
+	/* The payload. */
+	char data[];
+};
+
+struct mm_msgport
+{
+	/* The message ring. */
+	union {
+		struct mm_ring_spsc *spsc_ring;
+		struct mm_ring_mpmc *mpmc_ring;
+	};
+	/* The ring is shared by several senders. */
+	bool multi_sender;
+
+	/* The receiver task is blocked waiting for messages. */
+	mm_atomic_uint8_t receiver_blocked;
+
+	/* The port owner that receives messages. */
+	struct mm_task *task;
+
+	/* The number of messages that can be sent without blocking. */
+	mm_atomic_uint32_t credits __align_cacheline;
+
+	/* The number of senders that ran out of credits. */
+	mm_atomic_uint32_t nblocked;
+
+	/* The blocked senders state lock. */
+	mm_task_lock_t lock;
+	/* The senders blocked waiting for credits. */
+	struct mm_waitset blocked_senders;
+};
+
+/**********************************************************************
+ * Messages.
+ **********************************************************************/
+
+struct mm_msg * mm_msg_create(uint32_t size);
+
+void mm_msg_destroy(struct mm_msg *msg)
+	__attribute__((nonnull(1)));
+
+/**********************************************************************
+ * Message ports.
+ **********************************************************************/
+
+struct mm_msgport * mm_msgport_create(struct mm_task *task, uint32_t size,
+				      bool multi_sender)
+	__attribute__((nonnull(1)));
+
+void mm_msgport_destroy(struct mm_msgport *port)
+	__attribute__((nonnull(1)));
+
+/* Send a message unless out of credits. */
+bool mm_msgport_send(struct mm_msgport *port, struct mm_msg *msg)
+	__attribute__((nonnull(1, 2)));
+
+/* Send a message waiting for a credit if needed. */
+void mm_msgport_send_blocking(struct mm_msgport *port, struct mm_msg *msg)
+	__attribute__((nonnull(1, 2)));
+
+/* Receive up to the given number of messages without waiting. */
+uint32_t mm_msgport_receive(struct mm_msgport *port, struct mm_msg **msgs,
+			    uint32_t nmsgs)
+	__attribute__((nonnull(1, 2)));
+
+/* Receive up to the given number of messages waiting for at least one. */
+uint32_t mm_msgport_receive_blocking(struct mm_msgport *port,
+				     struct mm_msg **msgs, uint32_t nmsgs)
+	__attribute__((nonnull(1, 2)));
+
+#endif /* CORE_MSGPORT_H */
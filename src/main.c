@@ -26,6 +26,8 @@
 #include "base/log/plain.h"
 #include "base/log/trace.h"
 #include "base/mem/alloc.h"
+#include "base/settings.h"
+#include "base/sys/topology.h"
 #include "base/util/exit.h"
 
 #include "event/event.h"
@@ -33,7 +35,9 @@
 
 #include "memcache/memcache.h"
 
+#include <getopt.h>
 #include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -97,18 +101,217 @@ mm_cmd_reader(struct mm_net_socket *sock)
 	LEAVE();
 }
 
+/**********************************************************************
+ * Command line and configuration file settings.
+ **********************************************************************/
+
+struct mm_option
+{
+	const char *name;
+	const char *arg;
+	const char *help;
+};
+
+static const struct mm_option mm_options[] = {
+	{ "cores", "<n>",
+	  "the number of cores to run (all CPUs)" },
+	{ "event-affinity", "<cores>",
+	  "the cores that run event loops (0-3, spread over caches)" },
+	{ "test-address", "<addr>",
+	  "the test server address (127.0.0.1)" },
+	{ "test-port", "<port>",
+	  "the test server port (8000)" },
+	{ "memcache-address", "<addr>",
+	  "the memcache server address (" MC_ADDR_DEFAULT ")" },
+	{ "memcache-port", "<port>",
+	  "the memcache server port (11211)" },
+	{ "memcache-affinity", "<cores>",
+	  "the cores that handle memcache connections (all)" },
+	{ "memcache-volume", "<size>",
+	  "the maximum memcache data size (64m)" },
+	{ "memcache-access", "locking|combiner|delegate",
+	  "the memcache table access method (locking)" },
+	{ "memcache-partitions", "<n>",
+	  "the number of memcache table partitions (one per physical core)" },
+	{ "memcache-delegate-cores", "<cores>",
+	  "the cores that own memcache table partitions (non-SMT, non-event-loop)" },
+	{ "memcache-delegate-futures", "on|off",
+	  "pass delegate commands with futures rather than request rings (off)" },
+	{ "memcache-expiry-wheel", "on|off",
+	  "index memcache entries by expiration time (off)" },
+	{ "memcache-combiner-sort", "on|off",
+	  "order memcache combiner batches by table buckets (off)" },
+	{ "memcache-combiner-spin", "on|off",
+	  "spin rather than yield while waiting for memcache combiner (off)" },
+};
+
+#define MM_NOPTIONS (sizeof(mm_options) / sizeof(mm_options[0]))
+
+static void mm_usage(const char *name, int status)
+	__attribute__((noreturn));
+
+static void
+mm_usage(const char *name, int status)
+{
+	FILE *out = status == EXIT_SUCCESS ? stdout : stderr;
+
+	fprintf(out, "Usage: %s [-c <config-file>] [--<setting>=<value> ...]\n",
+		name);
+	fprintf(out, "\nSettings (from the command line or the config file):\n");
+	for (size_t i = 0; i < MM_NOPTIONS; i++)
+		fprintf(out, "  %s %s\n\t%s\n", mm_options[i].name,
+			mm_options[i].arg, mm_options[i].help);
+	fprintf(out, "\nCore lists look like 0-3,6,7. Sizes take k, m, g suffixes.\n");
+
+	exit(status);
+}
+
+static bool
+mm_option_check(const char *name)
+{
+	for (size_t i = 0; i < MM_NOPTIONS; i++) {
+		if (strcmp(mm_options[i].name, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void
+mm_args_parse(int ac, char *av[])
+{
+	ENTER();
+
+	struct option long_options[MM_NOPTIONS + 3];
+	for (size_t i = 0; i < MM_NOPTIONS; i++) {
+		long_options[i].name = mm_options[i].name;
+		long_options[i].has_arg = required_argument;
+		long_options[i].flag = NULL;
+		long_options[i].val = 0;
+	}
+	long_options[MM_NOPTIONS] = (struct option) { "config", required_argument, NULL, 'c' };
+	long_options[MM_NOPTIONS + 1] = (struct option) { "help", no_argument, NULL, 'h' };
+	long_options[MM_NOPTIONS + 2] = (struct option) { NULL, 0, NULL, 0 };
+
+	const char *config = NULL;
+	for (;;) {
+		int index;
+		int c = getopt_long(ac, av, "c:h", long_options, &index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 0:
+			// The command line overrides the config file.
+			mm_settings_set(mm_options[index].name, optarg, true);
+			break;
+		case 'c':
+			config = optarg;
+			break;
+		case 'h':
+			mm_usage(av[0], EXIT_SUCCESS);
+		default:
+			mm_usage(av[0], EXIT_FAILURE);
+		}
+	}
+	if (optind < ac)
+		mm_usage(av[0], EXIT_FAILURE);
+
+	if (config != NULL)
+		mm_settings_load(config, mm_option_check);
+
+	LEAVE();
+}
+
+static uint16_t
+mm_settings_get_port(const char *key, uint16_t def)
+{
+	uint32_t port = mm_settings_get_uint32(key, def);
+	if (port == 0 || port > UINT16_MAX)
+		mm_fatal(0, "invalid '%s' setting: %u", key, port);
+	return port;
+}
+
+static bool
+mm_settings_get_bool(const char *key, bool def)
+{
+	const char *value = mm_settings_get(key, NULL);
+	if (value == NULL)
+		return def;
+	if (strcmp(value, "on") == 0 || strcmp(value, "yes") == 0 || strcmp(value, "1") == 0)
+		return true;
+	if (strcmp(value, "off") == 0 || strcmp(value, "no") == 0 || strcmp(value, "0") == 0)
+		return false;
+	mm_fatal(0, "invalid '%s' setting: '%s'", key, value);
+}
+
+static mc_access_t
+mm_settings_get_access(const char *key, mc_access_t def)
+{
+	const char *value = mm_settings_get(key, NULL);
+	if (value == NULL)
+		return def;
+	if (strcmp(value, "locking") == 0)
+		return MC_ACCESS_LOCKING;
+	if (strcmp(value, "combiner") == 0)
+		return MC_ACCESS_COMBINER;
+	if (strcmp(value, "delegate") == 0)
+		return MC_ACCESS_DELEGATE;
+	mm_fatal(0, "invalid '%s' setting: '%s'", key, value);
+}
+
+/**********************************************************************
+ * Server initialization.
+ **********************************************************************/
+
+// The number of event loops by default.
+#define MM_EVENT_LOOPS_DEFAULT	4
+
+// Count the cores that run on distinct physical cores.
+static uint32_t
+mm_server_physical_cores(void)
+{
+	uint32_t n = 0;
+	for (mm_core_t i = 0; i < mm_core_getnum(); i++) {
+		if (mm_topology_is_primary(i))
+			n++;
+	}
+	return n;
+}
+
+// Choose the default delegate cores. These are the cores that do not
+// share a physical core with another one and do not run event loops.
+// If there are none then share the event loop cores.
+static void
+mm_server_delegate_cores(struct mm_bitset *cores, const struct mm_bitset *event_loop_cores)
+{
+	for (mm_core_t i = 0; i < mm_core_getnum(); i++) {
+		if (mm_topology_is_primary(i) && !mm_bitset_test(event_loop_cores, i))
+			mm_bitset_set(cores, i);
+	}
+	if (!mm_bitset_any(cores)) {
+		for (mm_core_t i = 0; i < mm_core_getnum(); i++) {
+			if (mm_topology_is_primary(i))
+				mm_bitset_set(cores, i);
+		}
+	}
+}
+
 static void
 mm_server_init(void)
 {
 	ENTER();
 
-	// Assign event loops to first three cores.
+	// Assign event loops to the configured cores. By default take
+	// the first few cores. Their placement alternates between the
+	// last-level cache domains and avoids SMT siblings.
 	struct mm_bitset event_loop_cores;
-	mm_bitset_prepare(&event_loop_cores, &mm_global_arena, 4);
-	mm_bitset_set(&event_loop_cores, 0);
-	mm_bitset_set(&event_loop_cores, 1);
-	mm_bitset_set(&event_loop_cores, 2);
-	mm_bitset_set(&event_loop_cores, 3);
+	mm_bitset_prepare(&event_loop_cores, &mm_global_arena, mm_core_getnum());
+	if (!mm_settings_get_cores("event-affinity", &event_loop_cores)) {
+		for (mm_core_t i = 0; i < MM_EVENT_LOOPS_DEFAULT && i < mm_core_getnum(); i++)
+			mm_bitset_set(&event_loop_cores, i);
+	}
+	if (!mm_bitset_any(&event_loop_cores))
+		mm_fatal(0, "no event loop cores");
 	mm_core_set_event_affinity(&event_loop_cores);
 
 	static struct mm_net_proto proto = {
@@ -122,27 +325,41 @@ mm_server_init(void)
 	mm_ucmd_server = mm_net_create_unix_server("test", &proto,
 						   "mm_cmd.sock");
 	mm_icmd_server = mm_net_create_inet_server("test", &proto,
-						   "127.0.0.1", 8000);
+						   mm_settings_get("test-address", "127.0.0.1"),
+						   mm_settings_get_port("test-port", 8000));
 
 	//mm_core_register_server(mm_ucmd_server);
 	mm_core_register_server(mm_icmd_server);
 
 	struct mm_memcache_config memcache_config;
-	memcache_config.volume = 64 * 1024 * 1024;
-#if ENABLE_MEMCACHE_DELEGATE
-	mm_bitset_prepare(&memcache_config.affinity, &mm_alloc_global, 8);
-	mm_bitset_set(&memcache_config.affinity, 6);
-	mm_bitset_set(&memcache_config.affinity, 7);
-#else
-	memcache_config.nparts = 1;
-#endif
+	memcache_config.addr = mm_settings_get("memcache-address", MC_ADDR_DEFAULT);
+	memcache_config.port = mm_settings_get_port("memcache-port", MC_PORT_DEFAULT);
+	mm_bitset_prepare(&memcache_config.net_affinity, &mm_global_arena, mm_core_getnum());
+	mm_settings_get_cores("memcache-affinity", &memcache_config.net_affinity);
+	memcache_config.volume = mm_settings_get_size("memcache-volume", MC_TABLE_VOLUME_DEFAULT);
+	memcache_config.access = mm_settings_get_access("memcache-access", MC_ACCESS_DEFAULT);
+	// Make one table partition per physical core by default.
+	uint32_t nparts = mm_settings_get_uint32("memcache-partitions", mm_server_physical_cores());
+	if (nparts == 0 || nparts >= MM_CORE_SELF)
+		mm_fatal(0, "invalid 'memcache-partitions' setting: %u", nparts);
+	memcache_config.nparts = nparts;
+	mm_bitset_prepare(&memcache_config.affinity, &mm_global_arena, mm_core_getnum());
+	if (!mm_settings_get_cores("memcache-delegate-cores", &memcache_config.affinity))
+		mm_server_delegate_cores(&memcache_config.affinity, &event_loop_cores);
+	memcache_config.delegate_futures = mm_settings_get_bool("memcache-delegate-futures", false);
+	memcache_config.expiry_wheel = mm_settings_get_bool("memcache-expiry-wheel", false);
+	memcache_config.combiner_sort = mm_settings_get_bool("memcache-combiner-sort", false);
+	memcache_config.combiner_spin = mm_settings_get_bool("memcache-combiner-spin", false);
 	mm_memcache_init(&memcache_config);
+	mm_bitset_cleanup(&event_loop_cores, &mm_global_arena);
+	mm_bitset_cleanup(&memcache_config.net_affinity, &mm_global_arena);
+	mm_bitset_cleanup(&memcache_config.affinity, &mm_global_arena);
 
 	LEAVE();
 }
 
 int
-main(/*int ac, char *av[]*/)
+main(int ac, char *av[])
 {
 	ENTER();
 
@@ -150,6 +367,10 @@ main(/*int ac, char *av[]*/)
 	mm_enable_verbose(true);
 	mm_enable_warning(true);
 
+	// Collect the settings.
+	mm_settings_init();
+	mm_args_parse(ac, av);
+
 	// Set signal handlers.
 	mm_signal_init();
 
@@ -164,6 +385,7 @@ main(/*int ac, char *av[]*/)
 
 	// Terminate subsystems.
 	mm_core_term();
+	mm_settings_term();
 
 	LEAVE();
 	return EXIT_SUCCESS;
@@ -19,57 +19,47 @@
 
 #include "memcache/action.h"
 #include "memcache/entry.h"
+#include "memcache/epoch.h"
+#include "memcache/wheel.h"
+
+#include "core/combiner.h"
+#include "core/task.h"
 
 #include "base/log/trace.h"
 
 #define MC_TABLE_STRIDE		64
 
+// The number of entries evicted at once by the eviction routine and by
+// a create action that runs out of free entries.
+#define MC_TABLE_EVICT		32
+#define MC_TABLE_CREATE_EVICT	8
+
+// The maximum number of entries dropped from the expiration wheel by
+// a single action.
+#define MC_TABLE_EXPIRE		32
+
 /**********************************************************************
  * Helper Routines.
  **********************************************************************/
 
 static bool
-mc_action_is_expired_entry(struct mc_tpart *part, struct mc_entry *entry, mm_timeval_t time)
+mc_action_is_expired_entry(struct mc_tpart *part, struct mc_entry *entry, uint32_t time)
 {
 	if (entry->exp_time && entry->exp_time <= time)
 		return true;
-	if (entry->stamp < part->flush_stamp)
+	if (entry->stamp < mm_atomic_uint64_load(&part->flush_stamp))
 		return true;
 	return false;
 }
 
 static bool
-mc_action_is_eviction_victim(struct mc_tpart *part, struct mc_entry *entry, mm_timeval_t time)
+mc_action_is_eviction_victim(struct mc_tpart *part, struct mc_entry *entry, uint32_t time)
 {
 	if (entry->state == MC_ENTRY_USED_MIN)
 		return true;
 	return mc_action_is_expired_entry(part, entry, time);
 }
 
-static void
-mc_action_ref_entry(struct mc_entry *entry)
-{
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	uint16_t test = mm_atomic_uint16_inc_and_test(&entry->ref_count);
-#else
-	uint16_t test = ++(entry->ref_count);
-#endif
-	// Integer overflow check.
-	if (unlikely(test == 0))
-		ABORT();
-}
-
-static bool
-mc_action_unref_entry(struct mc_entry *entry)
-{
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	uint16_t test = mm_atomic_uint16_dec_and_test(&entry->ref_count);
-#else
-	uint16_t test = --(entry->ref_count);
-#endif
-	return (test == 0);
-}
-
 static void
 mc_action_access_entry(struct mc_entry *entry)
 {
@@ -84,6 +74,8 @@ mc_action_unlink_entry(struct mc_tpart *part, struct mm_link *pred, struct mc_en
 	ASSERT(entry->state >= MC_ENTRY_USED_MIN);
 	ASSERT(entry->state <= MC_ENTRY_USED_MAX);
 	mm_link_cleave(pred, entry->link.next);
+	if (part->wheel != NULL && entry->exp_time)
+		mc_wheel_remove(part->wheel, entry);
 	entry->state = MC_ENTRY_NOT_USED;
 	part->volume -= mc_entry_size(entry);
 }
@@ -110,15 +102,60 @@ mc_action_free_entry(struct mc_tpart *part, struct mc_entry *entry)
 	part->nentries_free++;
 }
 
+static inline bool
+mc_action_unref_entry(struct mc_entry *entry, bool locking)
+{
+	if (locking)
+		return mc_entry_unref_shared(entry);
+	else
+		return mc_entry_unref(entry);
+}
+
+// Put an unreferenced entry aside until no command might read it.
 static void
-mc_action_free_entries(struct mc_tpart *part, struct mm_link *victims)
+mc_action_retire_entry(struct mc_tpart *part, struct mc_entry *entry, uint32_t epoch)
 {
+	entry->epoch = epoch;
+	mm_queue_append(&part->retired, &entry->link);
+	part->nentries_retired++;
+	part->volume_retired += mc_entry_size(entry);
+}
+
+static bool
+mc_action_reclaim_entries(struct mc_tpart *part)
+{
+	bool rc = false;
+	while (!mm_queue_empty(&part->retired)) {
+		struct mm_link *link = mm_queue_head(&part->retired);
+		struct mc_entry *entry = containerof(link, struct mc_entry, link);
+		if (!mc_epoch_reclaimable(entry->epoch))
+			break;
+
+		mm_queue_delete_head(&part->retired);
+		ASSERT(part->nentries_retired);
+		part->nentries_retired--;
+		ASSERT(part->volume_retired >= mc_entry_size(entry));
+		part->volume_retired -= mc_entry_size(entry);
+
+		mm_chunk_destroy_chain(mm_link_head(&entry->chunks));
+		mc_action_free_entry(part, entry);
+		rc = true;
+	}
+	return rc;
+}
+
+static inline __attribute__((always_inline)) void
+mc_action_free_entries(struct mc_tpart *part, struct mm_link *victims,
+		       bool locking)
+{
+	uint32_t epoch = MC_EPOCH_NONE;
 	while (!mm_link_empty(victims)) {
 		struct mm_link *link = mm_link_delete_head(victims);
 		struct mc_entry *entry = containerof(link, struct mc_entry, link);
-		if (mc_action_unref_entry(entry)) {
-			mm_chunk_destroy_chain(mm_link_head(&entry->chunks));
-			mc_action_free_entry(part, entry);
+		if (mc_action_unref_entry(entry, locking)) {
+			if (epoch == MC_EPOCH_NONE)
+				epoch = mc_epoch_retire();
+			mc_action_retire_entry(part, entry, epoch);
 		}
 	}
 }
@@ -128,7 +165,7 @@ mc_action_drop_expired(struct mc_tpart *part,
 		       struct mm_link *bucket,
 		       struct mm_link *expired)
 {
-	mm_timeval_t time = mm_core->time_manager.time;
+	uint32_t time = mc_table_time();
 	mm_link_init(expired);
 
 	struct mm_link *pred = bucket;
@@ -144,12 +181,31 @@ mc_action_drop_expired(struct mc_tpart *part,
 	}
 }
 
+// Drop the entries that the expiration wheel has reached.
+static void
+mc_action_drop_wheel(struct mc_tpart *part, struct mm_link *expired)
+{
+	if (part->wheel == NULL)
+		return;
+
+	uint32_t time = mc_table_time();
+	for (uint32_t count = 0; count < MC_TABLE_EXPIRE; count++) {
+		struct mc_entry *entry = mc_wheel_expired(part->wheel, time);
+		if (entry == NULL)
+			break;
+
+		uint32_t index = mc_table_index(part, entry->hash);
+		mc_action_remove_entry(part, &part->buckets[index], entry);
+		mm_link_insert(expired, &entry->link);
+	}
+}
+
 static bool
 mc_action_find_victims(struct mc_tpart *part,
 		       struct mm_link *victims,
 		       uint32_t nrequired)
 {
-	mm_timeval_t time = mm_core->time_manager.time;
+	uint32_t time = mc_table_time();
 	uint32_t nvictims = 0;
 	mm_link_init(victims);
 
@@ -181,6 +237,7 @@ mc_action_find_victims(struct mc_tpart *part,
 		part->clock_hand = hand + 1;
 	}
 
+	part->nevicted += nvictims;
 	return (nvictims > 0 && nvictims == nrequired);
 }
 
@@ -202,9 +259,10 @@ mc_action_bucket_insert(struct mc_action *action,
 	ASSERT(action->new_entry->state == MC_ENTRY_NOT_USED);
 	ASSERT(state != MC_ENTRY_NOT_USED || state != MC_ENTRY_FREE);
 	action->new_entry->state = state;
-	action->new_entry->stamp = action->part->stamp;
+	action->new_entry->stamp = mc_table_stamp();
 	mm_link_insert(bucket, &action->new_entry->link);
-	action->part->stamp += mc_table.nparts;
+	if (action->part->wheel != NULL && action->new_entry->exp_time)
+		mc_wheel_insert(action->part->wheel, action->new_entry);
 	action->part->volume += mc_entry_size(action->new_entry);
 }
 
@@ -228,6 +286,28 @@ mc_action_bucket_lookup(struct mc_action *action,
 	action->old_entry = NULL;
 }
 
+static void
+mc_action_bucket_find(struct mc_action *action, struct mm_link *bucket)
+{
+	// Expired entries are skipped but not removed here as this might
+	// run concurrently with other lookups. They are dropped later by
+	// table updates or eviction.
+	uint32_t time = mc_table_time();
+	struct mm_link *link = mm_link_head(bucket);
+	while (link != NULL) {
+		struct mc_entry *entry = containerof(link, struct mc_entry, link);
+		if (mc_action_match_entry(action, entry)
+		    && !mc_action_is_expired_entry(action->part, entry, time)) {
+			ASSERT(entry->state >= MC_ENTRY_USED_MIN);
+			ASSERT(entry->state <= MC_ENTRY_USED_MAX);
+			action->old_entry = entry;
+			return;
+		}
+		link = link->next;
+	}
+	action->old_entry = NULL;
+}
+
 static void
 mc_action_bucket_delete(struct mc_action *action,
 			struct mm_link *bucket,
@@ -281,141 +361,143 @@ mc_action_bucket_update(struct mc_action *action,
  * Table Actions.
  **********************************************************************/
 
-void
-mc_action_lookup_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_lookup_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
-	struct mm_link freelist;
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_read_lock(action->part, locking);
 
 	uint32_t index = mc_table_index(action->part, action->hash);
 	struct mm_link *bucket = &action->part->buckets[index];
 
-	mc_action_bucket_lookup(action, bucket, &freelist);
+	mc_action_bucket_find(action, bucket);
 	if (action->old_entry != NULL) {
-		mc_action_ref_entry(action->old_entry);
 		mc_action_access_entry(action->old_entry);
+		// Every core counts its own hits.
+		(*MM_CDATA_DEREF(mm_core_selfid(), action->part->nhits))++;
 	}
 
-	mc_table_lookup_unlock(action->part);
-	if (!mm_link_empty(&freelist)) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &freelist);
-		mc_table_freelist_unlock(action->part);
-	}
+	mc_table_lookup_read_unlock(action->part, locking);
 
 	LEAVE();
 }
 
-void
-mc_action_finish_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_finish_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
 	struct mc_entry *entry = action->old_entry;
-	if (mc_action_unref_entry(entry)) {
-		mm_chunk_destroy_chain(mm_link_head(&entry->chunks));
+	if (mc_action_unref_entry(entry, locking)) {
+		uint32_t epoch = mc_epoch_retire();
 
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entry(action->part, action->old_entry);
-		mc_table_freelist_unlock(action->part);
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_retire_entry(action->part, entry, epoch);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	LEAVE();
 }
 
-void
-mc_action_delete_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_delete_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
 	struct mm_link finish_list;
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_lock(action->part, locking);
 
 	uint32_t index = mc_table_index(action->part, action->hash);
 	struct mm_link *bucket = &action->part->buckets[index];
 
 	mc_action_bucket_delete(action, bucket, &finish_list);
+	mc_action_drop_wheel(action->part, &finish_list);
 
-	mc_table_lookup_unlock(action->part);
+	mc_table_lookup_unlock(action->part, locking);
 	if (!mm_link_empty(&finish_list)) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &finish_list);
-		mc_table_freelist_unlock(action->part);
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &finish_list, locking);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	LEAVE();
 }
 
-void
-mc_action_create_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_create_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
-	mc_table_freelist_lock(action->part);
-
-	for (;;) {
-		if (!mm_link_empty(&action->part->free_list)) {
-			struct mm_link *link = mm_link_delete_head(&action->part->free_list);
-			action->new_entry = containerof(link, struct mc_entry, link);
-			ASSERT(action->part->nentries_free);
-			action->part->nentries_free--;
-			break;
-		}
+	struct mc_entry *entry = NULL;
+	mc_table_freelist_lock(action->part, locking);
+
+	// Recycle the entries that no command might read any more.
+	mc_action_reclaim_entries(action->part);
+
+	if (!mm_link_empty(&action->part->free_list)) {
+		struct mm_link *link = mm_link_delete_head(&action->part->free_list);
+		entry = containerof(link, struct mc_entry, link);
+		ASSERT(action->part->nentries_free);
+		action->part->nentries_free--;
+	} else if (action->part->nentries_void) {
+		entry = action->part->entries_end++;
+		action->part->nentries_void--;
+	} else if (mc_table_expand(action->part, mc_table.nentries_increment)) {
+		ASSERT(action->part->nentries_void);
+		entry = action->part->entries_end++;
+		action->part->nentries_void--;
+	}
 
-		if (action->part->nentries_void) {
-			action->new_entry = action->part->entries_end++;
-			action->part->nentries_void--;
-			break;
-		}
-		if (mc_table_expand(action->part, mc_table.nentries_increment)) {
-			ASSERT(action->part->nentries_void);
-			action->new_entry = action->part->entries_end++;
-			action->part->nentries_void--;
-			break;
-		}
+	if (entry != NULL) {
+		ASSERT(entry->state == MC_ENTRY_FREE);
+		entry->state = MC_ENTRY_NOT_USED;
+		entry->ref_count = 1;
+	}
 
-		mc_table_freelist_unlock(action->part);
+	mc_table_freelist_unlock(action->part, locking);
+	action->new_entry = entry;
 
+	if (entry == NULL) {
+		// The entries evicted now are retired in the epoch pinned
+		// by the current command itself so they cannot be reused
+		// right away. Make room for the caller to retry later.
 		struct mm_link victims;
-		mc_table_lookup_lock(action->part);
-		mc_action_find_victims(action->part, &victims, 1);
-		mc_table_lookup_unlock(action->part);
-
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &victims);
+		mc_table_lookup_lock(action->part, locking);
+		mc_action_find_victims(action->part, &victims, MC_TABLE_CREATE_EVICT);
+		mc_table_lookup_unlock(action->part, locking);
+
+		if (!mm_link_empty(&victims)) {
+			mc_table_freelist_lock(action->part, locking);
+			mc_action_free_entries(action->part, &victims, locking);
+			mc_table_freelist_unlock(action->part, locking);
+		}
 	}
 
-	ASSERT(action->new_entry->state == MC_ENTRY_FREE);
-	action->new_entry->state = MC_ENTRY_NOT_USED;
-	action->new_entry->ref_count = 1;
-
-	mc_table_freelist_unlock(action->part);
 	mc_table_reserve_entries(action->part);
 
 	LEAVE();
 }
 
-void
-mc_action_cancel_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_cancel_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
-	mc_table_freelist_lock(action->part);
+	mc_table_freelist_lock(action->part, locking);
 	mc_action_free_entry(action->part, action->new_entry);
-	mc_table_freelist_unlock(action->part);
+	mc_table_freelist_unlock(action->part, locking);
 
 	LEAVE();
 }
 
-void
-mc_action_insert_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_insert_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
 	struct mm_link freelist;
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_lock(action->part, locking);
 
 	uint32_t index = mc_table_index(action->part, action->hash);
 	struct mm_link *bucket = &action->part->buckets[index];
@@ -423,16 +505,17 @@ mc_action_insert_low(struct mc_action *action)
 	mc_action_bucket_lookup(action, bucket, &freelist);
 	if (action->old_entry == NULL)
 		mc_action_bucket_insert(action, bucket, MC_ENTRY_USED_MIN);
+	mc_action_drop_wheel(action->part, &freelist);
 
-	mc_table_lookup_unlock(action->part);
+	mc_table_lookup_unlock(action->part, locking);
 	if (!mm_link_empty(&freelist)) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &freelist);
-		mc_table_freelist_unlock(action->part);
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &freelist, locking);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	if (action->old_entry != NULL) {
-		mc_action_cancel_low(action);
+		mc_action_cancel_low(action, locking);
 	} else {
 		mc_table_reserve_volume(action->part);
 	}
@@ -440,63 +523,59 @@ mc_action_insert_low(struct mc_action *action)
 	LEAVE();
 }
 
-void
-mc_action_update_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_update_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
 	struct mm_link freelist;
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_lock(action->part, locking);
 
 	uint32_t index = mc_table_index(action->part, action->hash);
 	struct mm_link *bucket = &action->part->buckets[index];
 
 	mc_action_bucket_update(action, bucket, &freelist, action->match_stamp);
-	if (action->entry_match) {
-		if (action->ref_new_on_success)
-			mc_action_ref_entry(action->new_entry);
+	if (action->entry_match)
 		mc_action_access_entry(action->new_entry);
-	}
+	mc_action_drop_wheel(action->part, &freelist);
 
-	mc_table_lookup_unlock(action->part);
+	mc_table_lookup_unlock(action->part, locking);
 	if (!mm_link_empty(&freelist)) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &freelist);
-		mc_table_freelist_unlock(action->part);
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &freelist, locking);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	if (action->entry_match) {
 		mc_table_reserve_volume(action->part);
 	} else {
-		if (action->ref_old_on_failure)
-			mc_action_ref_entry(action->old_entry);
-
 		mm_chunk_destroy_chain(mm_link_head(&action->new_entry->chunks));
-		mc_action_cancel_low(action);
+		mc_action_cancel_low(action, locking);
 	}
 
 	LEAVE();
 }
 
-void
-mc_action_upsert_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_upsert_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
 	struct mm_link freelist;
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_lock(action->part, locking);
 
 	uint32_t index = mc_table_index(action->part, action->hash);
 	struct mm_link *bucket = &action->part->buckets[index];
 
 	mc_action_bucket_delete(action, bucket, &freelist);
 	mc_action_bucket_insert(action, bucket, MC_ENTRY_USED_MIN);
+	mc_action_drop_wheel(action->part, &freelist);
 
-	mc_table_lookup_unlock(action->part);
+	mc_table_lookup_unlock(action->part, locking);
 	if (!mm_link_empty(&freelist)) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &freelist);
-		mc_table_freelist_unlock(action->part);
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &freelist, locking);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	mc_table_reserve_volume(action->part);
@@ -504,12 +583,45 @@ mc_action_upsert_low(struct mc_action *action)
 	LEAVE();
 }
 
-void
-mc_action_stride_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_touch_low(struct mc_action *action, const bool locking)
+{
+	ENTER();
+
+	struct mm_link freelist;
+	mc_table_lookup_lock(action->part, locking);
+
+	uint32_t index = mc_table_index(action->part, action->hash);
+	struct mm_link *bucket = &action->part->buckets[index];
+
+	mc_action_bucket_lookup(action, bucket, &freelist);
+	if (action->old_entry != NULL) {
+		struct mc_entry *entry = action->old_entry;
+		struct mc_wheel *wheel = action->part->wheel;
+		if (wheel != NULL && entry->exp_time)
+			mc_wheel_remove(wheel, entry);
+		entry->exp_time = action->exp_time;
+		if (wheel != NULL && entry->exp_time)
+			mc_wheel_insert(wheel, entry);
+	}
+	mc_action_drop_wheel(action->part, &freelist);
+
+	mc_table_lookup_unlock(action->part, locking);
+	if (!mm_link_empty(&freelist)) {
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &freelist, locking);
+		mc_table_freelist_unlock(action->part, locking);
+	}
+
+	LEAVE();
+}
+
+static inline __attribute__((always_inline)) void
+mc_action_stride_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
-	mc_table_lookup_lock(action->part);
+	mc_table_lookup_lock(action->part, locking);
 
 	uint32_t used = action->part->nbuckets;
 
@@ -553,88 +665,236 @@ mc_action_stride_low(struct mc_action *action)
 	used += MC_TABLE_STRIDE;
 	action->part->nbuckets = used;
 
-	mc_table_lookup_unlock(action->part);
+	mc_table_lookup_unlock(action->part, locking);
 
 	LEAVE();
 }
 
-void
-mc_action_evict_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_evict_low(struct mc_action *action, const bool locking)
 {
 	ENTER();
 
-	struct mm_link victims;
-	mc_table_lookup_lock(action->part);
-	bool found = mc_action_find_victims(action->part, &victims, 32);
-	mc_table_lookup_unlock(action->part);
+	// Reclaim the retired entries first as they count against the
+	// volume too.
+	mc_table_freelist_lock(action->part, locking);
+	mc_action_reclaim_entries(action->part);
+	mc_table_freelist_unlock(action->part, locking);
 
-	if (found) {
-		mc_table_freelist_lock(action->part);
-		mc_action_free_entries(action->part, &victims);
-		mc_table_freelist_unlock(action->part);
+	struct mm_link victims;
+	mc_table_lookup_lock(action->part, locking);
+	mc_action_find_victims(action->part, &victims, MC_TABLE_EVICT);
+	mc_action_drop_wheel(action->part, &victims);
+	mc_table_lookup_unlock(action->part, locking);
+
+	if (!mm_link_empty(&victims)) {
+		mc_table_freelist_lock(action->part, locking);
+		mc_action_free_entries(action->part, &victims, locking);
+		mc_table_freelist_unlock(action->part, locking);
 	}
 
 	LEAVE();
 }
 
-void
-mc_action_flush_low(struct mc_action *action)
+static inline __attribute__((always_inline)) void
+mc_action_flush_low(struct mc_action *action, const bool locking __attribute__((unused)))
 {
 	ENTER();
 
-	mc_table_lookup_lock(action->part);
-	action->part->flush_stamp = action->part->stamp;
-	mc_table_lookup_unlock(action->part);
+	// The flush stamp only grows so it needs no lock. Concurrent
+	// flushes must not lower it so raise it with CAS.
+	uint64_t stamp = mc_table_flush_stamp();
+	uint64_t prev = mm_atomic_uint64_load(&action->part->flush_stamp);
+	while (stamp > prev) {
+		uint64_t seen = mm_atomic_uint64_cas(&action->part->flush_stamp,
+						     prev, stamp);
+		if (seen == prev)
+			break;
+		prev = seen;
+	}
 
 	LEAVE();
 }
 
-#if ENABLE_MEMCACHE_COMBINER
+/**********************************************************************
+ * Table Action Specialization.
+ **********************************************************************/
+
+// Define action variants for exclusive table access. These are used
+// by the combiner and by the delegate cores that own the partitions.
+#define MC_ACTION_EXCLUSIVE(name, tag)				\
+	static void						\
+	mc_action_##name##_exclusive(struct mc_action *action)	\
+	{							\
+		mc_action_##name##_low(action, false);		\
+	}
+
+MC_ACTION_LIST(MC_ACTION_EXCLUSIVE)
+
+#undef MC_ACTION_EXCLUSIVE
+
+// Define action variants for table access with locking.
+#define MC_ACTION_LOCKING(name, tag)				\
+	static void						\
+	mc_action_##name##_locking(struct mc_action *action)	\
+	{							\
+		mc_action_##name##_low(action, true);		\
+	}
+
+MC_ACTION_LIST(MC_ACTION_LOCKING)
+
+#undef MC_ACTION_LOCKING
+
+// The combiner access completion mark.
+#define MC_ACTION_COMPLETED	((void *) (uintptr_t) 1)
+
+static void
+mc_action_combine_spin(struct mc_action *action, mc_action_t tag)
+{
+	action->action = tag;
+	action->waiter = NULL;
+	mm_combiner_execute(&action->part->combiner->combiner, (uintptr_t) action);
+
+	// Wait for the combiner to perform the action.
+	while (mm_memory_load(action->waiter) != MC_ACTION_COMPLETED)
+		mm_spin_pause();
+	mm_memory_load_fence();
+}
+
+static void
+mc_action_combine(struct mc_action *action, mc_action_t tag)
+{
+	action->action = tag;
+	action->waiter = NULL;
+
+	// Tasks of the same core take turns to enter the combiner. While
+	// one of them is there the others are blocked and the core runs
+	// any other ready tasks.
+	mm_task_combiner_execute(action->part->combiner, (uintptr_t) action);
+
+	// Unless the action is already performed (it always is if this
+	// task did the combining) let the combiner wake the task up when
+	// it is done.
+	struct mm_task *task = mm_task_self();
+	if (mm_atomic_ptr_cas(&action->waiter, NULL, task) == NULL) {
+		while (mm_memory_load(action->waiter) != MC_ACTION_COMPLETED)
+			mm_task_block();
+	}
+	mm_memory_load_fence();
+}
+
+// Define action variants for table access via combiner.
+#define MC_ACTION_COMBINER(name, tag)				\
+	static void						\
+	mc_action_##name##_combiner(struct mc_action *action)	\
+	{							\
+		mc_action_combine(action, tag);			\
+	}							\
+	static void						\
+	mc_action_##name##_combiner_spin(struct mc_action *action) \
+	{							\
+		mc_action_combine_spin(action, tag);		\
+	}
+
+MC_ACTION_LIST(MC_ACTION_COMBINER)
+
+#undef MC_ACTION_COMBINER
 
 void
 mc_action_perform(uintptr_t data)
 {
 	struct mc_action *action = (struct mc_action *) data;
+
+#define MC_ACTION_CASE(name, tag)				\
+	case tag:						\
+		mc_action_##name##_exclusive(action);		\
+		break;
+
+	switch (action->action) {
+	MC_ACTION_LIST(MC_ACTION_CASE)
+	default:
+		ABORT();
+	}
+
+#undef MC_ACTION_CASE
+
+	// Mark the action as completed. The action memory belongs to the
+	// requester after this so it must not be touched any more.
+	mm_memory_store_fence();
+	struct mm_task *waiter = mm_atomic_ptr_fetch_and_set(&action->waiter,
+							     MC_ACTION_COMPLETED);
+	if (waiter != NULL)
+		mm_core_run_task(waiter);
+}
+
+// Order combined actions by the bucket they address.
+uintptr_t
+mc_action_sort_key(uintptr_t data)
+{
+	struct mc_action *action = (struct mc_action *) data;
+
 	switch (action->action) {
 	case MC_ACTION_LOOKUP:
-		mc_action_lookup_low(action);
-		break;
-	case MC_ACTION_FINISH:
-		mc_action_finish_low(action);
-		break;
 	case MC_ACTION_DELETE:
-		mc_action_delete_low(action);
-		break;
-	case MC_ACTION_CREATE:
-		mc_action_create_low(action);
-		break;
-	case MC_ACTION_CANCEL:
-		mc_action_cancel_low(action);
-		break;
 	case MC_ACTION_INSERT:
-		mc_action_insert_low(action);
-		break;
 	case MC_ACTION_UPDATE:
-		mc_action_update_low(action);
-		break;
 	case MC_ACTION_UPSERT:
-		mc_action_upsert_low(action);
-		break;
-	case MC_ACTION_STRIDE:
-		mc_action_stride_low(action);
-		break;
-	case MC_ACTION_EVICT:
-		mc_action_evict_low(action);
-		break;
-	case MC_ACTION_FLUSH:
-		mc_action_flush_low(action);
-		break;
+	case MC_ACTION_TOUCH:
+		return mc_table_index(action->part, action->hash);
 	default:
-		ABORT();
+		// Other actions do not address a bucket.
+		return 0;
 	}
-
-	mm_memory_store_fence();
-	action->action = MC_ACTION_DONE;
 }
 
+/**********************************************************************
+ * Table Action Dispatch.
+ **********************************************************************/
+
+#define MC_ACTION_OP(name, tag)		.name = mc_action_##name##_exclusive,
+static const struct mc_action_ops mc_action_ops_exclusive = {
+	MC_ACTION_LIST(MC_ACTION_OP)
+};
+#undef MC_ACTION_OP
+
+#define MC_ACTION_OP(name, tag)		.name = mc_action_##name##_locking,
+static const struct mc_action_ops mc_action_ops_locking = {
+	MC_ACTION_LIST(MC_ACTION_OP)
+};
+#undef MC_ACTION_OP
+
+#define MC_ACTION_OP(name, tag)		.name = mc_action_##name##_combiner,
+static const struct mc_action_ops mc_action_ops_combiner = {
+	MC_ACTION_LIST(MC_ACTION_OP)
+};
+#undef MC_ACTION_OP
+
+#define MC_ACTION_OP(name, tag)		.name = mc_action_##name##_combiner_spin,
+static const struct mc_action_ops mc_action_ops_combiner_spin = {
+	MC_ACTION_LIST(MC_ACTION_OP)
+};
+#undef MC_ACTION_OP
+
+const struct mc_action_ops *
+mc_action_ops_select(mc_access_t access, bool spin)
+{
+	switch (access) {
+	case MC_ACCESS_LOCKING:
+#if ENABLE_SMP
+		return &mc_action_ops_locking;
+#else
+		// A single core never runs two actions at once.
+		(void) mc_action_ops_locking;
+		return &mc_action_ops_exclusive;
 #endif
+	case MC_ACCESS_COMBINER:
+		if (spin)
+			return &mc_action_ops_combiner_spin;
+		return &mc_action_ops_combiner;
+	case MC_ACCESS_DELEGATE:
+		// Only the owner core accesses a partition.
+		return &mc_action_ops_exclusive;
+	default:
+		ABORT();
+	}
+}
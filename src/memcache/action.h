@@ -24,15 +24,10 @@
 #include "memcache/table.h"
 #include "core/core.h"
 
-#if ENABLE_MEMCACHE_COMBINER
-# include "base/combiner.h"
-#endif
+#include "base/combiner.h"
 
-#if ENABLE_MEMCACHE_COMBINER
 typedef enum {
 
-	MC_ACTION_DONE,
-
 	/* Search for an entry. */
 	MC_ACTION_LOOKUP,
 	/* Finish using found entry. */
@@ -51,15 +46,35 @@ typedef enum {
 	MC_ACTION_UPDATE,
 	/* Either insert new or replace existing entry. */
 	MC_ACTION_UPSERT,
+	/* Set expiration time of existing entry. */
+	MC_ACTION_TOUCH,
 
+	/* Split some buckets of a growing table. */
 	MC_ACTION_STRIDE,
-
+	/* Evict some entries to reclaim space. */
 	MC_ACTION_EVICT,
-
+	/* Invalidate all existing entries. */
 	MC_ACTION_FLUSH,
 
 } mc_action_t;
-#endif
+
+/*
+ * Some preprocessor magic to emit action definitions.
+ */
+
+#define MC_ACTION_LIST(_)			\
+	_(lookup,	MC_ACTION_LOOKUP)	\
+	_(finish,	MC_ACTION_FINISH)	\
+	_(delete,	MC_ACTION_DELETE)	\
+	_(create,	MC_ACTION_CREATE)	\
+	_(cancel,	MC_ACTION_CANCEL)	\
+	_(insert,	MC_ACTION_INSERT)	\
+	_(update,	MC_ACTION_UPDATE)	\
+	_(upsert,	MC_ACTION_UPSERT)	\
+	_(touch,	MC_ACTION_TOUCH)	\
+	_(stride,	MC_ACTION_STRIDE)	\
+	_(evict,	MC_ACTION_EVICT)	\
+	_(flush,	MC_ACTION_FLUSH)
 
 struct mc_action
 {
@@ -74,217 +89,123 @@ struct mc_action
 
 	uint64_t stamp;
 
-#if ENABLE_MEMCACHE_COMBINER
+	/* The requested action for combiner access. */
 	mc_action_t action;
-#endif
+	/* The task waiting for combiner access to complete. */
+	mm_atomic_ptr_t waiter;
+
+	/* Input expiration time for touch. */
+	uint32_t exp_time;
 
 	/* Input flag indicating if update should check entry stamp. */
 	bool match_stamp;
-	/* Input flags indicating if update should retain old and new
-	   entry references after the action. */
-	bool ref_old_on_failure;
-	bool ref_new_on_success;
 	/* Output flag indicating if the entry match succeeded. */
 	bool entry_match;
 };
 
-void mc_action_lookup_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
-
-void mc_action_finish_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
-
-void mc_action_delete_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+/**********************************************************************
+ * Table action dispatch.
+ **********************************************************************/
 
-void mc_action_create_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
-
-void mc_action_cancel_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
-
-void mc_action_insert_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+/*
+ * Table actions specialized for a table access method. The table
+ * keeps a pointer to one of these so every action costs an indirect
+ * call rather than a chain of access method checks.
+ */
 
-void mc_action_update_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+#define MC_ACTION_OP(name, tag)	void (*name)(struct mc_action *action);
 
-void mc_action_upsert_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+struct mc_action_ops
+{
+	MC_ACTION_LIST(MC_ACTION_OP)
+};
 
-void mc_action_stride_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+#undef MC_ACTION_OP
 
-void mc_action_evict_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+const struct mc_action_ops * mc_action_ops_select(mc_access_t access, bool spin);
 
-void mc_action_flush_low(struct mc_action *action)
-	__attribute__((nonnull(1)));
+void mc_action_perform(uintptr_t data);
 
-static inline void
-mc_action_wait(struct mc_action *action __attribute__((unused)))
-{
-#if ENABLE_MEMCACHE_COMBINER
-	while (action->action != MC_ACTION_DONE)
-		mm_spin_pause();
-	mm_memory_load_fence();
-#endif
-}
+uintptr_t mc_action_sort_key(uintptr_t data);
 
 static inline void
 mc_action_lookup(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_LOOKUP;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_lookup_low(action);
-#endif
+	(mc_table.ops->lookup)(action);
 }
 
 static inline void
 mc_action_finish(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_FINISH;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_finish_low(action);
-#endif
+	(mc_table.ops->finish)(action);
 }
 
 static inline void
 mc_action_delete(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_DELETE;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_delete_low(action);
-#endif
+	(mc_table.ops->delete)(action);
 }
 
 static inline void
 mc_action_create(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_CREATE;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_create_low(action);
-#endif
+	(mc_table.ops->create)(action);
 }
 
 static inline void
 mc_action_cancel(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_CANCEL;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_cancel_low(action);
-#endif
+	(mc_table.ops->cancel)(action);
 }
 
 static inline void
 mc_action_insert(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_INSERT;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_insert_low(action);
-#endif
+	(mc_table.ops->insert)(action);
 }
 
 static inline void
 mc_action_update(struct mc_action *action)
 {
 	action->match_stamp = false;
-	action->ref_old_on_failure = false;
-	action->ref_new_on_success = false;
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_UPDATE;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_update_low(action);
-#endif
+	(mc_table.ops->update)(action);
 }
 
 static inline void
-mc_action_compare_and_update(struct mc_action *action,
-			     bool ref_old_on_failure,
-			     bool ref_new_on_success)
+mc_action_compare_and_update(struct mc_action *action)
 {
 	action->match_stamp = true;
-	action->ref_old_on_failure = ref_old_on_failure;
-	action->ref_new_on_success = ref_new_on_success;
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_UPDATE;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_update_low(action);
-#endif
+	(mc_table.ops->update)(action);
 }
 
 static inline void
 mc_action_upsert(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_UPSERT;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_upsert_low(action);
-#endif
+	(mc_table.ops->upsert)(action);
+}
+
+static inline void
+mc_action_touch(struct mc_action *action)
+{
+	(mc_table.ops->touch)(action);
 }
 
 static inline void
 mc_action_stride(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_STRIDE;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_stride_low(action);
-#endif
+	(mc_table.ops->stride)(action);
 }
 
 static inline void
 mc_action_evict(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_EVICT;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_evict_low(action);
-#endif
+	(mc_table.ops->evict)(action);
 }
 
 static inline void
 mc_action_flush(struct mc_action *action)
 {
-#if ENABLE_MEMCACHE_COMBINER
-	action->action = MC_ACTION_FLUSH;
-	mm_combiner_execute(action->part->combiner, (uintptr_t) action);
-	mc_action_wait(action);
-#else
-	mc_action_flush_low(action);
-#endif
+	(mc_table.ops->flush)(action);
 }
 
-#if ENABLE_MEMCACHE_COMBINER
-void mc_action_perform(uintptr_t data);
-#endif
-
 #endif /* MEMCACHE_ACTION_H */
@@ -19,6 +19,8 @@
 
 #include "memcache/command.h"
 #include "memcache/entry.h"
+#include "memcache/epoch.h"
+#include "memcache/hotkey.h"
 #include "memcache/table.h"
 
 #include "core/task.h"
@@ -37,6 +39,9 @@ static mm_timeval_t mc_exptime;
 
 static struct mm_pool mc_command_pool;
 
+// The table command execution routine for the table access method.
+static void (*mc_command_execute_table)(struct mc_command *command);
+
 /**********************************************************************
  * Command type declarations.
  **********************************************************************/
@@ -82,17 +87,105 @@ MC_COMMAND_LIST(MC_COMMAND_TYPE)
 
 #undef MC_COMMAND_TYPE
 
+/**********************************************************************
+ * Command execution with different table access methods.
+ **********************************************************************/
+
+static void
+mc_command_execute_direct(struct mc_command *command)
+{
+	command->result = (command->type->exec)((mm_value_t) command);
+}
+
+static void
+mc_command_future_complete(struct mm_future *future __attribute__((unused)),
+			   mm_value_t result, mm_value_t data)
+{
+	struct mc_command *command = (struct mc_command *) data;
+	if (result == MM_RESULT_CANCELED)
+		result = MC_RESULT_CANCELED;
+	command->result = result;
+	if (command->waiter != NULL)
+		mm_task_run(command->waiter);
+}
+
+static void
+mc_command_execute_future(struct mc_command *command)
+{
+	command->result = MC_RESULT_FUTURE;
+	command->future = mm_future_create(command->type->exec,
+					   (mm_value_t) command);
+	mm_future_then(command->future, mc_command_future_complete,
+		       (mm_value_t) command);
+	mm_future_start(command->future, command->action.part->core);
+}
+
+static mm_value_t
+mc_command_request_execute(mm_value_t arg)
+{
+	struct mm_request *request = (struct mm_request *) arg;
+	struct mc_command *command = containerof(request, struct mc_command, request);
+	return (command->type->exec)((mm_value_t) command);
+}
+
+static void
+mc_command_request_complete(struct mm_request *request)
+{
+	struct mc_command *command = containerof(request, struct mc_command, request);
+	command->result = request->result;
+	if (command->waiter != NULL)
+		mm_task_run(command->waiter);
+}
+
+static void
+mc_command_execute_request(struct mc_command *command)
+{
+	command->result = MC_RESULT_REQUEST;
+	command->request.execute = mc_command_request_execute;
+	command->request.complete = mc_command_request_complete;
+	mm_core_request(command->action.part->core, &command->request);
+}
+
+mc_result_t
+mc_command_wait(struct mc_command *command)
+{
+	ENTER();
+
+	// Both futures and requests complete on this core so the waiter
+	// is always woken up after the result is set.
+	mc_result_t result;
+	command->waiter = mm_task_self();
+	for (;;) {
+		result = command->result;
+		if (result != MC_RESULT_FUTURE && result != MC_RESULT_REQUEST)
+			break;
+		mm_task_block();
+	}
+	command->waiter = NULL;
+
+	LEAVE();
+	return result;
+}
+
 /**********************************************************************
  * Memcache command pool initialization and termination.
  **********************************************************************/
 
 void
-mc_command_start(void)
+mc_command_start(const struct mm_memcache_config *config)
 {
 	ENTER();
 
 	mm_pool_prepare_shared(&mc_command_pool, "memcache command", sizeof(struct mc_command));
 
+	// With delegate access table commands run on the partition cores.
+	if (mc_table.access != MC_ACCESS_DELEGATE)
+		mc_command_execute_table = mc_command_execute_direct;
+	else if (config->delegate_futures)
+		mc_command_execute_table = mc_command_execute_future;
+	else
+		mc_command_execute_table = mc_command_execute_request;
+
 	LEAVE();
 }
 
@@ -130,22 +223,13 @@ mc_command_destroy(mm_core_t core, struct mc_command *command)
 	if (command->own_key)
 		mm_local_free((char *) command->action.key);
 
-	switch (mc_command_result(command)) {
-	case MC_RESULT_VALUE:
-		command->action.old_entry = command->action.new_entry;
-	case MC_RESULT_ENTRY:
-	case MC_RESULT_ENTRY_CAS:
-		mc_action_finish(&command->action);
-		break;
-
-	default:
-		break;
-	}
+	// Make sure the command is done with the table before unpinning.
+	mc_command_result(command);
+	if (command->pinned)
+		mc_epoch_unpin(command->epoch);
 
-#if ENABLE_MEMCACHE_DELEGATE
 	if (command->future != NULL)
 		mm_future_destroy(command->future);
-#endif
 
 	mm_pool_shared_free_low(core, &mc_command_pool, command);
 
@@ -166,17 +250,13 @@ mc_command_execute(struct mc_command *command)
 		command->action.hash = mc_hash(command->action.key,
 					       command->action.key_len);
 		command->action.part = mc_table_part(command->action.hash);
-
-#if ENABLE_MEMCACHE_DELEGATE
-		command->result_type = MC_RESULT_FUTURE;
-		command->future = mm_future_create(command->type->exec,
-						   (mm_value_t) command);
-		mm_future_start(command->future, command->action.part->core);
-		return;
-#endif
+		command->epoch = mc_epoch_pin();
+		command->pinned = true;
+		command->pin_core = mm_core_selfid();
+		(mc_command_execute_table)(command);
+	} else {
+		mc_command_execute_direct(command);
 	}
-
-	command->result = (command->type->exec)((mm_value_t) command);
 }
 
 static void
@@ -209,6 +289,40 @@ mc_command_process_value(struct mc_entry *entry,
 	LEAVE();
 }
 
+// Wait for the table to free some entries after a failed creation. If
+// possible renew the epoch pin meanwhile so that the entries evicted for
+// the command itself might be reclaimed. The entries read by the command
+// before are not safe to use after this.
+static void
+mc_command_wait_entry(struct mc_command *command)
+{
+	ENTER();
+
+	if (command->pinned && command->pin_core == mm_core_selfid()) {
+		mc_epoch_unpin(command->epoch);
+		mm_task_yield();
+		command->epoch = mc_epoch_pin();
+	} else {
+		mm_task_yield();
+	}
+
+	LEAVE();
+}
+
+static void
+mc_command_create_entry(struct mc_command *command)
+{
+	ENTER();
+
+	mc_action_create(&command->action);
+	while (command->action.new_entry == NULL) {
+		mc_command_wait_entry(command);
+		mc_action_create(&command->action);
+	}
+
+	LEAVE();
+}
+
 static mm_value_t
 mc_command_process_get2(mm_value_t arg, mc_result_t entry_rc)
 {
@@ -216,7 +330,10 @@ mc_command_process_get2(mm_value_t arg, mc_result_t entry_rc)
 
 	struct mc_command *command = (struct mc_command *) arg;
 
-	mc_action_lookup(&command->action);
+	// Try a core-local replica first.
+	if (!mc_hotkey_lookup(&command->action))
+		mc_action_lookup(&command->action);
+	mc_hotkey_sample(&command->action);
 
 	mc_result_t rc;
 	if (command->action.old_entry != NULL)
@@ -250,7 +367,7 @@ mc_command_exec_set(mm_value_t arg)
 	struct mc_command *command = (struct mc_command *) arg;
 	struct mc_command_params_set *params = &command->params.set;
 
-	mc_action_create(&command->action);
+	mc_command_create_entry(command);
 	mc_entry_set(command->action.new_entry, &command->action,
 		     params->flags, params->exptime, params->bytes);
 	mc_command_process_value(command->action.new_entry, params, 0);
@@ -274,7 +391,7 @@ mc_command_exec_add(mm_value_t arg)
 	struct mc_command *command = (struct mc_command *) arg;
 	struct mc_command_params_set *params = &command->params.set;
 
-	mc_action_create(&command->action);
+	mc_command_create_entry(command);
 	mc_entry_set(command->action.new_entry, &command->action,
 		     params->flags, params->exptime, params->bytes);
 	mc_command_process_value(command->action.new_entry, params, 0);
@@ -300,7 +417,7 @@ mc_command_exec_replace(mm_value_t arg)
 	struct mc_command *command = (struct mc_command *) arg;
 	struct mc_command_params_set *params = &command->params.set;
 
-	mc_action_create(&command->action);
+	mc_command_create_entry(command);
 	mc_entry_set(command->action.new_entry, &command->action,
 		     params->flags, params->exptime, params->bytes);
 	mc_command_process_value(command->action.new_entry, params, 0);
@@ -326,11 +443,11 @@ mc_command_exec_cas(mm_value_t arg)
 	struct mc_command *command = (struct mc_command *) arg;
 	struct mc_command_params_set *params = &command->params.set;
 
-	mc_action_create(&command->action);
+	mc_command_create_entry(command);
 	mc_entry_set(command->action.new_entry, &command->action,
 		     params->flags, params->exptime, params->bytes);
 	mc_command_process_value(command->action.new_entry, params, 0);
-	mc_action_compare_and_update(&command->action, false, false);
+	mc_action_compare_and_update(&command->action);
 
 	mc_result_t rc;
 	if (command->noreply)
@@ -362,6 +479,12 @@ mc_command_exec_append(mm_value_t arg)
 		char *old_value = mc_entry_getvalue(old_entry);
 
 		mc_action_create(&command->action);
+		if (command->action.new_entry == NULL) {
+			// Start over as the old entry might be gone.
+			mc_command_wait_entry(command);
+			mc_action_lookup(&command->action);
+			continue;
+		}
 		struct mc_entry *new_entry = command->action.new_entry;
 		mc_entry_set(new_entry, &command->action,
 			     params->flags, params->exptime, value_len);
@@ -370,8 +493,7 @@ mc_command_exec_append(mm_value_t arg)
 		mc_command_process_value(new_entry, params, old_entry->value_len);
 		command->action.stamp = old_entry->stamp;
 
-		mc_action_finish(&command->action);
-		mc_action_compare_and_update(&command->action, true, false);
+		mc_action_compare_and_update(&command->action);
 
 		if (command->action.entry_match)
 			break;
@@ -405,6 +527,12 @@ mc_command_exec_prepend(mm_value_t arg)
 		char *old_value = mc_entry_getvalue(old_entry);
 
 		mc_action_create(&command->action);
+		if (command->action.new_entry == NULL) {
+			// Start over as the old entry might be gone.
+			mc_command_wait_entry(command);
+			mc_action_lookup(&command->action);
+			continue;
+		}
 		struct mc_entry *new_entry = command->action.new_entry;
 		mc_entry_set(new_entry, &command->action,
 			     params->flags, params->exptime, value_len);
@@ -413,9 +541,7 @@ mc_command_exec_prepend(mm_value_t arg)
 		memcpy(new_value + params->bytes, old_value, old_entry->value_len);
 
 		command->action.stamp = old_entry->stamp;
-		mc_action_finish(&command->action);
-
-		mc_action_compare_and_update(&command->action, true, false);
+		mc_action_compare_and_update(&command->action);
 
 		if (command->action.entry_match)
 			break;
@@ -445,22 +571,25 @@ mc_command_exec_incr(mm_value_t arg)
 
 	while (command->action.old_entry != NULL) {
 		uint64_t value;
-		if (!mc_entry_getnum(command->action.old_entry, &value)) {
-			mc_action_finish(&command->action);
+		if (!mc_entry_getnum(command->action.old_entry, &value))
 			break;
-		}
 		value += command->params.val64;
 
 		command->action.stamp = command->action.old_entry->stamp;
-		mc_action_finish(&command->action);
 
 		mc_action_create(&command->action);
+		if (command->action.new_entry == NULL) {
+			// Start over as the old entry might be gone.
+			mc_command_wait_entry(command);
+			mc_action_lookup(&command->action);
+			continue;
+		}
 		mc_entry_setnum(command->action.new_entry, &command->action,
 				command->action.old_entry->flags,
 				command->action.old_entry->exp_time,
 				value);
 
-		mc_action_compare_and_update(&command->action, true, true);
+		mc_action_compare_and_update(&command->action);
 
 		if (command->action.entry_match)
 			break;
@@ -492,25 +621,28 @@ mc_command_exec_decr(mm_value_t arg)
 
 	while (command->action.old_entry != NULL) {
 		uint64_t value;
-		if (!mc_entry_getnum(command->action.old_entry, &value)) {
-			mc_action_finish(&command->action);
+		if (!mc_entry_getnum(command->action.old_entry, &value))
 			break;
-		}
 		if (value > command->params.val64)
 			value -= command->params.val64;
 		else
 			value = 0;
 
 		command->action.stamp = command->action.old_entry->stamp;
-		mc_action_finish(&command->action);
 
 		mc_action_create(&command->action);
+		if (command->action.new_entry == NULL) {
+			// Start over as the old entry might be gone.
+			mc_command_wait_entry(command);
+			mc_action_lookup(&command->action);
+			continue;
+		}
 		mc_entry_setnum(command->action.new_entry, &command->action,
 				command->action.old_entry->flags,
 				command->action.old_entry->exp_time,
 				value);
 
-		mc_action_compare_and_update(&command->action, true, true);
+		mc_action_compare_and_update(&command->action);
 
 		if (command->action.entry_match)
 			break;
@@ -558,24 +690,10 @@ mc_command_exec_touch(mm_value_t arg)
 
 	struct mc_command *command = (struct mc_command *) arg;
 
-	mc_action_lookup(&command->action);
-
-	if (command->action.old_entry != NULL) {
-		// There is no much need for synchronization here.
-		// * A concurrent touch is not a big problem. Nobody knows
-		// which one of them is set to win;
-		// * If we set exptime on an entry that has concurrently
-		// been deleted then there is absolutely no harm;
-		// * If we set exptime on an entry that has concurrently
-		// been replaced then the replace command has its own
-		// exptime which wins and this seems to be just fine;
-		// * If we set exptime on an entry that is being incremented
-		// or decremented then admittedly we might loose the exptime
-		// update. But after all who is going to ever sensibly use
-		// exptime and incr/decr together?
-		command->action.old_entry->exp_time = command->params.val32;
-		mc_action_finish(&command->action);
-	}
+	// The expiration time is changed under the table lock as the
+	// entry might have to move in the expiration wheel.
+	command->action.exp_time = command->params.val32;
+	mc_action_touch(&command->action);
 
 	mc_result_t rc;
 	if (command->noreply)
@@ -595,6 +713,16 @@ mc_command_exec_slabs(mm_value_t arg __attribute__((unused)))
 	return MC_RESULT_NOT_IMPLEMENTED;
 }
 
+static bool
+mc_command_stats_option(struct mc_command *command, const char *option)
+{
+	struct mc_command_params_stats *stats = &command->params.stats;
+	if (stats->nopts != 1)
+		return false;
+	size_t len = strlen(option);
+	return stats->option_len == len && memcmp(stats->option, option, len) == 0;
+}
+
 static mm_value_t
 mc_command_exec_stats(mm_value_t arg)
 {
@@ -603,15 +731,36 @@ mc_command_exec_stats(mm_value_t arg)
 	struct mc_command *command = (struct mc_command *) arg;
 
 	mc_result_t rc;
-	if (command->params.stats.nopts)
-		rc = MC_RESULT_NOT_IMPLEMENTED;
-	else
+	if (command->params.stats.nopts == 0)
 		rc = MC_RESULT_END;
+	else if (mc_command_stats_option(command, "locks"))
+		rc = MC_RESULT_LOCK_STATS;
+	else if (mc_command_stats_option(command, "hotkeys"))
+		rc = MC_RESULT_HOTKEY_STATS;
+	else if (mc_command_stats_option(command, "flow"))
+		rc = MC_RESULT_FLOW_STATS;
+	else if (mc_command_stats_option(command, "combiners"))
+		rc = MC_RESULT_COMBINER_STATS;
+	else
+		rc = MC_RESULT_NOT_IMPLEMENTED;
 
 	LEAVE();
 	return rc;
 }
 
+static mm_value_t
+mc_command_flush_routine(mm_value_t arg)
+{
+	ENTER();
+
+	struct mc_action action;
+	action.part = &mc_table.parts[arg];
+	mc_action_flush(&action);
+
+	LEAVE();
+	return 0;
+}
+
 static mm_value_t
 mc_command_exec_flush_all(mm_value_t arg)
 {
@@ -623,14 +772,11 @@ mc_command_exec_flush_all(mm_value_t arg)
 	mc_exptime = mc_curtime + command->params.val32 * 1000000ull;
 
 	for (mm_core_t i = 0; i < mc_table.nparts; i++) {
-#if ENABLE_MEMCACHE_DELEGATE
 		struct mc_tpart *part = &mc_table.parts[i];
-		mm_core_post(part->core, mc_process_flush, i);
-#else
-		struct mc_action action;
-		action.part = &mc_table.parts[i];
-		mc_action_flush(&action);
-#endif
+		if (part->core != MM_CORE_NONE)
+			mm_core_post(part->core, mc_command_flush_routine, i);
+		else
+			mc_command_flush_routine(i);
 	}
 
 	mc_result_t rc;
@@ -23,6 +23,7 @@
 #include "memcache/memcache.h"
 #include "memcache/action.h"
 #include "memcache/result.h"
+#include "core/core.h"
 #include "core/future.h"
 
 /**********************************************************************
@@ -113,9 +114,14 @@ struct mc_command_params_slabs
 	uint32_t nopts;
 };
 
+#define MC_STATS_OPTION_SIZE	16
+
 struct mc_command_params_stats
 {
 	uint32_t nopts;
+	/* The first option if it is short enough. */
+	uint8_t option_len;
+	char option[MC_STATS_OPTION_SIZE];
 };
 
 union mc_command_params
@@ -137,10 +143,17 @@ struct mc_command
 	mc_result_t result;
 	bool noreply;
 	bool own_key;
+	/* The command holds an epoch pin for the entries it reads. */
+	bool pinned;
+	uint32_t epoch;
+	/* The core that holds the pin. */
+	mm_core_t pin_core;
 
-#if ENABLE_MEMCACHE_DELEGATE
+	/* The pending result with delegate table access. */
 	struct mm_future *future;
-#endif
+	struct mm_request request;
+	/* The task waiting for the request completion. */
+	struct mm_task *waiter;
 
 	struct mc_command *next;
 
@@ -153,7 +166,8 @@ const char * mc_command_name(mc_command_t tag);
  * Command routines.
  **********************************************************************/
 
-void mc_command_start(void);
+void mc_command_start(const struct mm_memcache_config *config)
+	__attribute__((nonnull(1)));
 void mc_command_stop(void);
 
 struct mc_command * mc_command_create(mm_core_t core);
@@ -161,18 +175,15 @@ void mc_command_destroy(mm_core_t core, struct mc_command *command);
 
 void mc_command_execute(struct mc_command *command);
 
+mc_result_t mc_command_wait(struct mc_command *command)
+	__attribute__((nonnull(1)));
+
 static inline mc_result_t
 mc_command_result(struct mc_command *command)
 {
 	mc_result_t result = command->result;
-#if ENABLE_MEMCACHE_DELEGATE
-	if (result == MC_RESULT_FUTURE) {
-		result = mm_future_wait(command->future);
-		if (mm_future_is_canceled(command->future))
-			result = MC_RESULT_CANCELED;
-		command->result = result;
-	}
-#endif
+	if (unlikely(result == MC_RESULT_FUTURE || result == MC_RESULT_REQUEST))
+		result = mc_command_wait(command);
 	return result;
 }
 
@@ -22,13 +22,12 @@
 
 #include "memcache/memcache.h"
 
+#include "arch/atomic.h"
+
 #include "base/list.h"
+#include "base/log/debug.h"
 #include "base/mem/chunk.h"
 
-#if !ENABLE_MEMCACHE_COMBINER
-# include "arch/atomic.h"
-#endif
-
 /* Forward declaration. */
 struct mc_action;
 
@@ -41,24 +40,90 @@ struct mc_entry
 {
 	struct mm_link link;
 	struct mm_link chunks;
+	/* The link in the expiration wheel if the table keeps one. */
+	struct mm_list expiry;
 
 	uint32_t hash;
 	uint32_t exp_time;
 	uint32_t flags;
 
-#if ENABLE_MEMCACHE_COMBINER
-	uint16_t ref_count;
-#else
+	/* The number of long-lived references: the table itself and the
+	   hot key replicas. Commands that only read the entry pin the
+	   epoch instead. */
 	mm_atomic_uint16_t ref_count;
-#endif
 
 	uint8_t state;
 
 	uint8_t key_len;
 	uint32_t value_len;
+	/* The epoch the entry is retired in. */
+	uint32_t epoch;
 	uint64_t stamp;
 };
 
+/* Entry reference counting for table access confined to a single
+   thread at a time (combiner and delegate). */
+
+static inline void
+mc_entry_ref(struct mc_entry *entry)
+{
+	entry->ref_count++;
+	ASSERT(entry->ref_count != 0);
+}
+
+static inline bool
+mc_entry_unref(struct mc_entry *entry)
+{
+	uint16_t test = --(entry->ref_count);
+	return (test == 0);
+}
+
+/* Entry reference counting for concurrent table access (locking). */
+
+static inline void
+mc_entry_ref_shared(struct mc_entry *entry)
+{
+#if ENABLE_SMP
+	mm_atomic_uint16_inc(&entry->ref_count);
+#else
+	entry->ref_count++;
+#endif
+}
+
+/* Take a reference only if the entry still has one. A zero count means
+   that the entry is already retired and must not be revived. */
+static inline bool
+mc_entry_ref_shared_live(struct mc_entry *entry)
+{
+#if ENABLE_SMP
+	uint16_t count = mm_memory_load(entry->ref_count);
+	while (count != 0) {
+		uint16_t prev = mm_atomic_uint16_cas(&entry->ref_count,
+						     count, count + 1);
+		if (prev == count)
+			return true;
+		count = prev;
+	}
+	return false;
+#else
+	if (entry->ref_count == 0)
+		return false;
+	entry->ref_count++;
+	return true;
+#endif
+}
+
+static inline bool
+mc_entry_unref_shared(struct mc_entry *entry)
+{
+#if ENABLE_SMP
+	uint16_t test = mm_atomic_uint16_dec_and_test(&entry->ref_count);
+#else
+	uint16_t test = --(entry->ref_count);
+#endif
+	return (test == 0);
+}
+
 static inline size_t
 mc_entry_sum_length(uint8_t key_len, size_t value_len)
 {
@@ -0,0 +1,170 @@
+/*
+ * memcache/epoch.c - MainMemory memcache entry reclamation epochs.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memcache/epoch.h"
+
+#include "core/core.h"
+
+#include "arch/atomic.h"
+
+#include "base/log/trace.h"
+#include "base/mem/cdata.h"
+#include "base/thr/domain.h"
+
+// Per-core epoch data.
+struct mc_epoch_core
+{
+	// The oldest epoch with pins on this core or MC_EPOCH_NONE. This
+	// is read by other cores.
+	uint32_t active;
+
+	// The pin counts for the active epoch and the next one. The global
+	// epoch cannot advance any further while there are pins.
+	uint32_t npins[2];
+};
+
+// The epoch advances in steps of two so it is always even and can never
+// wrap around to MC_EPOCH_NONE. The pin counts are indexed with the next
+// bit.
+#define MC_EPOCH_STEP		2
+#define MC_EPOCH_INDEX(e)	(((e) / MC_EPOCH_STEP) & 1)
+
+// The global epoch.
+static mm_atomic_uint32_t mc_epoch_global;
+
+static MM_CDATA(struct mc_epoch_core, mc_epoch_data);
+
+static inline struct mc_epoch_core *
+mc_epoch_core(void)
+{
+	return MM_CDATA_DEREF(mm_core_selfid(), mc_epoch_data);
+}
+
+/**********************************************************************
+ * Epoch initialization.
+ **********************************************************************/
+
+void
+mc_epoch_init(void)
+{
+	ENTER();
+
+	mc_epoch_global = 0;
+
+	MM_CDATA_ALLOC(mm_domain_self(), "memcache epochs", mc_epoch_data);
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_epoch_core *data = MM_CDATA_DEREF(core, mc_epoch_data);
+		data->active = MC_EPOCH_NONE;
+		data->npins[0] = 0;
+		data->npins[1] = 0;
+	}
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Epoch pinning.
+ **********************************************************************/
+
+uint32_t
+mc_epoch_pin(void)
+{
+	struct mc_epoch_core *data = mc_epoch_core();
+
+	uint32_t epoch = mm_memory_load(mc_epoch_global);
+	if (data->active == MC_EPOCH_NONE) {
+		// Announce the epoch before accessing the table. Retry if
+		// the epoch has advanced meanwhile.
+		for (;;) {
+			mm_memory_store(data->active, epoch);
+			mm_memory_strict_fence();
+
+			uint32_t check = mm_memory_load(mc_epoch_global);
+			if (check == epoch)
+				break;
+			epoch = check;
+		}
+	}
+
+	data->npins[MC_EPOCH_INDEX(epoch)]++;
+	return epoch;
+}
+
+void
+mc_epoch_unpin(uint32_t epoch)
+{
+	struct mc_epoch_core *data = mc_epoch_core();
+	ASSERT(data->active != MC_EPOCH_NONE);
+	ASSERT(data->npins[MC_EPOCH_INDEX(epoch)]);
+
+	data->npins[MC_EPOCH_INDEX(epoch)]--;
+
+	uint32_t active = data->active;
+	if (data->npins[MC_EPOCH_INDEX(active)] == 0) {
+		uint32_t next = active + MC_EPOCH_STEP;
+		if (data->npins[MC_EPOCH_INDEX(next)] != 0)
+			mm_memory_store(data->active, next);
+		else
+			mm_memory_store(data->active, MC_EPOCH_NONE);
+	}
+}
+
+/**********************************************************************
+ * Entry retirement and reclamation.
+ **********************************************************************/
+
+uint32_t
+mc_epoch_retire(void)
+{
+	// Make sure that the entry removal is visible before reading the
+	// epoch.
+	mm_memory_strict_fence();
+	return mm_memory_load(mc_epoch_global);
+}
+
+static void
+mc_epoch_advance(uint32_t epoch)
+{
+	ENTER();
+
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_epoch_core *data = MM_CDATA_DEREF(core, mc_epoch_data);
+		uint32_t active = mm_memory_load(data->active);
+		if (active != MC_EPOCH_NONE && active != epoch)
+			goto leave;
+	}
+
+	mm_atomic_uint32_cas(&mc_epoch_global, epoch, epoch + MC_EPOCH_STEP);
+
+leave:
+	LEAVE();
+}
+
+bool
+mc_epoch_reclaimable(uint32_t epoch)
+{
+	uint32_t global = mm_memory_load(mc_epoch_global);
+	if ((global - epoch) >= 2 * MC_EPOCH_STEP)
+		return true;
+
+	mc_epoch_advance(global);
+
+	global = mm_memory_load(mc_epoch_global);
+	return (global - epoch) >= 2 * MC_EPOCH_STEP;
+}
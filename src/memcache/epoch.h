@@ -0,0 +1,57 @@
+/*
+ * memcache/epoch.h - MainMemory memcache entry reclamation epochs.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMCACHE_EPOCH_H
+#define MEMCACHE_EPOCH_H
+
+#include "memcache/memcache.h"
+
+/*
+ * Entries removed from the table might still be read by commands that
+ * found them before the removal. Instead of counting references to every
+ * entry such commands pin the current epoch on their core. A removed
+ * entry is retired in the current epoch and it is reclaimed only after
+ * the epoch is advanced twice. The epoch advances only when every core
+ * either has no pins or has them in the current epoch. So the readers
+ * touch only core-local data and a retired entry outlives any reader
+ * that might have seen it.
+ *
+ * A command keeps the pin until the entry value is written out to the
+ * client. If the client cannot take the value right away it is copied
+ * to the connection buffer and the pin is dropped so that a stalled
+ * connection does not delay reclamation of all the entries retired after
+ * that.
+ */
+
+#define MC_EPOCH_NONE		((uint32_t) -1)
+
+void mc_epoch_init(void);
+
+uint32_t mc_epoch_pin(void);
+
+void mc_epoch_unpin(uint32_t epoch);
+
+/* Get the epoch to retire entries in. */
+uint32_t mc_epoch_retire(void);
+
+/* Check if the entries retired in the given epoch might be reclaimed.
+   Tries to advance the epoch if they cannot. */
+bool mc_epoch_reclaimable(uint32_t epoch);
+
+#endif /* MEMCACHE_EPOCH_H */
@@ -0,0 +1,256 @@
+/*
+ * memcache/flow.c - MainMemory memcache flow control.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memcache/flow.h"
+#include "memcache/state.h"
+
+#include "core/core.h"
+#include "core/task.h"
+#include "core/wait.h"
+
+#include "base/log/trace.h"
+#include "base/mem/cdata.h"
+#include "base/thr/domain.h"
+
+#include "net/netbuf.h"
+
+// Per-core flow control data.
+struct mc_flow_core
+{
+	// The number of commands queued for transmission.
+	uint32_t nqueued;
+	// The number of bytes in connection transmit buffers.
+	size_t ntransmit;
+
+	// Statistics.
+	uint32_t nqueued_max;
+	size_t ntransmit_max;
+	uint64_t npaused;
+	uint64_t nresponses;
+	uint64_t nwrites;
+	uint64_t nbudget;
+	uint64_t nadmit;
+	uint64_t nthrottled;
+};
+
+static MM_CDATA(struct mc_flow_core, mc_flow_data);
+
+static inline struct mc_flow_core *
+mc_flow_core(void)
+{
+	return MM_CDATA_DEREF(mm_core_selfid(), mc_flow_data);
+}
+
+static void
+mc_flow_throttle(struct mc_flow_core *data, struct mc_state *state)
+{
+	if (!state->throttled) {
+		state->throttled = true;
+		data->nthrottled++;
+	}
+}
+
+/**********************************************************************
+ * Flow control data initialization.
+ **********************************************************************/
+
+void
+mc_flow_start(void)
+{
+	ENTER();
+
+	MM_CDATA_ALLOC(mm_domain_self(), "memcache flow control", mc_flow_data);
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_flow_core *data = MM_CDATA_DEREF(core, mc_flow_data);
+		memset(data, 0, sizeof(struct mc_flow_core));
+	}
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Command queue accounting.
+ **********************************************************************/
+
+void
+mc_flow_enqueue(uint32_t n)
+{
+	struct mc_flow_core *data = mc_flow_core();
+	data->nqueued += n;
+	if (data->nqueued_max < data->nqueued)
+		data->nqueued_max = data->nqueued;
+}
+
+void
+mc_flow_dequeue(uint32_t n)
+{
+	struct mc_flow_core *data = mc_flow_core();
+	ASSERT(data->nqueued >= n);
+	data->nqueued -= n;
+}
+
+/**********************************************************************
+ * Transmit accounting.
+ **********************************************************************/
+
+void
+mc_flow_written(uint32_t nresponses)
+{
+	struct mc_flow_core *data = mc_flow_core();
+	data->nresponses += nresponses;
+	data->nwrites++;
+}
+
+void
+mc_flow_transmit(struct mc_state *state, size_t size)
+{
+	ENTER();
+
+	struct mc_flow_core *data = mc_flow_core();
+	data->ntransmit -= state->tbuf_size;
+	data->ntransmit += size;
+	if (data->ntransmit_max < data->ntransmit)
+		data->ntransmit_max = data->ntransmit;
+
+	// Resume a paused reader if the buffer has drained.
+	bool paused = state->tbuf_size > MC_FLOW_TBUF_LOW;
+	state->tbuf_size = size;
+	if (paused && size <= MC_FLOW_TBUF_LOW)
+		mm_waitset_local_broadcast(&state->drain_waitset);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Reader flow control.
+ **********************************************************************/
+
+static void
+mc_flow_drain(struct mc_state *state)
+{
+	ENTER();
+
+	struct mm_net_socket *sock = &state->sock.sock;
+	while (state->tbuf_size > MC_FLOW_TBUF_LOW) {
+		if (mm_net_is_reader_shutdown(sock))
+			break;
+		if (mm_net_is_writer_shutdown(sock))
+			break;
+
+		// Make sure there is a writer to drain the buffer. If the
+		// socket is not ready for writing the writer might give up
+		// so kick it again after a while.
+		mm_net_spawn_writer(sock);
+		if (state->tbuf_size <= MC_FLOW_TBUF_LOW)
+			break;
+		mm_waitset_local_timedwait(&state->drain_waitset,
+					   MC_FLOW_DRAIN_TIMEOUT);
+	}
+
+	LEAVE();
+}
+
+void
+mc_flow_control(struct mc_state *state, struct mc_flow_budget *budget)
+{
+	struct mc_flow_core *data = mc_flow_core();
+
+	// Stop parsing until the transmit buffer drains.
+	if (unlikely(state->tbuf_size >= MC_FLOW_TBUF_HIGH)) {
+		mc_flow_throttle(data, state);
+		data->npaused++;
+		mc_flow_drain(state);
+	}
+
+	// Let the other connections run if the budget is used up.
+	if (unlikely(budget->commands == 0 || budget->bytes == 0)) {
+		ENTER();
+
+		mc_flow_throttle(data, state);
+		data->nbudget++;
+		mc_start_writer(state);
+		mm_task_yield();
+
+		mc_flow_budget_reset(budget);
+
+		LEAVE();
+	}
+
+	// Let the writers drain the core queue if it is too long. Don't
+	// wait for ever though as a writer might be stuck with a client
+	// that does not read its responses.
+	if (unlikely(data->nqueued >= MC_FLOW_QUEUE_LIMIT)) {
+		ENTER();
+
+		mc_flow_throttle(data, state);
+		data->nadmit++;
+		mc_start_writer(state);
+		for (int i = 0; i < MC_FLOW_QUEUE_ROUNDS; i++) {
+			mm_task_yield();
+			if (data->nqueued < MC_FLOW_QUEUE_LIMIT)
+				break;
+		}
+
+		LEAVE();
+	}
+}
+
+/**********************************************************************
+ * Flow control statistics.
+ **********************************************************************/
+
+void
+mc_flow_stats(struct mm_netbuf_socket *sock)
+{
+	ENTER();
+
+	size_t ntransmit = 0;
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_flow_core *data = MM_CDATA_DEREF(core, mc_flow_data);
+		mm_netbuf_printf(sock,
+				 "STAT flow:%u:queued %u\r\n"
+				 "STAT flow:%u:queued_max %u\r\n"
+				 "STAT flow:%u:transmit_bytes %zu\r\n"
+				 "STAT flow:%u:transmit_bytes_max %zu\r\n"
+				 "STAT flow:%u:budget_yields %llu\r\n"
+				 "STAT flow:%u:admission_waits %llu\r\n"
+				 "STAT flow:%u:transmit_pauses %llu\r\n"
+				 "STAT flow:%u:throttled_conns %llu\r\n"
+				 "STAT flow:%u:responses %llu\r\n"
+				 "STAT flow:%u:writes %llu\r\n"
+				 "STAT flow:%u:responses_per_write %.2f\r\n",
+				 core, data->nqueued,
+				 core, data->nqueued_max,
+				 core, data->ntransmit,
+				 core, data->ntransmit_max,
+				 core, (unsigned long long) data->nbudget,
+				 core, (unsigned long long) data->nadmit,
+				 core, (unsigned long long) data->npaused,
+				 core, (unsigned long long) data->nthrottled,
+				 core, (unsigned long long) data->nresponses,
+				 core, (unsigned long long) data->nwrites,
+				 core, data->nwrites
+				 ? (double) data->nresponses / data->nwrites : 0.0);
+		ntransmit += data->ntransmit;
+	}
+
+	mm_netbuf_printf(sock, "STAT flow:transmit_bytes %zu\r\n", ntransmit);
+
+	LEAVE();
+}
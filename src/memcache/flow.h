@@ -0,0 +1,104 @@
+/*
+ * memcache/flow.h - MainMemory memcache flow control.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMCACHE_FLOW_H
+#define MEMCACHE_FLOW_H
+
+#include "memcache/memcache.h"
+
+/* Forward declarations. */
+struct mc_state;
+struct mm_netbuf_socket;
+
+/*
+ * A connection reader processes pipelined commands until it uses up its
+ * budget for the current round. Then it yields the core to let the other
+ * connections proceed. Additionally the reader is held back while the
+ * number of commands queued on the core for transmission is above the
+ * limit.
+ *
+ * Also a reader stops parsing commands when the connection transmit
+ * buffer reaches the high-water mark. It resumes when the writer drains
+ * the buffer down to the low-water mark. So a client that does not read
+ * its responses cannot make the server buffer unbounded amounts of data
+ * and hold references to the transmitted entries.
+ */
+
+/* The per-round reader budget. */
+#define MC_FLOW_BUDGET_COMMANDS	(64)
+#define MC_FLOW_BUDGET_BYTES	(64 * 1024)
+
+/* The limit of the queued commands on a core. */
+#define MC_FLOW_QUEUE_LIMIT	(4096)
+/* The maximum number of rounds a reader is held back. */
+#define MC_FLOW_QUEUE_ROUNDS	(16)
+
+/* The connection transmit buffer water marks. */
+#define MC_FLOW_TBUF_HIGH	(256 * 1024)
+#define MC_FLOW_TBUF_LOW	(64 * 1024)
+/* The transmit buffer drain check interval. */
+#define MC_FLOW_DRAIN_TIMEOUT	(10000)
+
+struct mc_flow_budget
+{
+	/* The commands and bytes left for the current round. */
+	uint32_t commands;
+	uint32_t bytes;
+};
+
+void mc_flow_start(void);
+
+void mc_flow_enqueue(uint32_t n);
+void mc_flow_dequeue(uint32_t n);
+
+void mc_flow_written(uint32_t nresponses);
+
+void mc_flow_transmit(struct mc_state *state, size_t size)
+	__attribute__((nonnull(1)));
+
+void mc_flow_control(struct mc_state *state, struct mc_flow_budget *budget)
+	__attribute__((nonnull(1, 2)));
+
+void mc_flow_stats(struct mm_netbuf_socket *sock)
+	__attribute__((nonnull(1)));
+
+static inline void
+mc_flow_budget_reset(struct mc_flow_budget *budget)
+{
+	budget->commands = MC_FLOW_BUDGET_COMMANDS;
+	budget->bytes = MC_FLOW_BUDGET_BYTES;
+}
+
+static inline void
+mc_flow_charge_command(struct mc_flow_budget *budget)
+{
+	if (budget->commands)
+		budget->commands--;
+}
+
+static inline void
+mc_flow_charge_bytes(struct mc_flow_budget *budget, size_t n)
+{
+	if (n < budget->bytes)
+		budget->bytes -= n;
+	else
+		budget->bytes = 0;
+}
+
+#endif /* MEMCACHE_FLOW_H */
@@ -0,0 +1,284 @@
+/*
+ * memcache/hotkey.c - MainMemory memcache hot key detection.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memcache/hotkey.h"
+#include "memcache/action.h"
+#include "memcache/entry.h"
+#include "memcache/table.h"
+
+#include "core/core.h"
+
+#include "base/log/trace.h"
+#include "base/mem/cdata.h"
+#include "base/thr/domain.h"
+
+#include "net/netbuf.h"
+
+// The upper limit for a sample count so that a key that cooled down
+// could be displaced quickly enough.
+#define MC_HOTKEY_COUNT_MAX	(4 * MC_HOTKEY_THRESHOLD)
+
+// A sampled key slot.
+struct mc_hotkey_slot
+{
+	// The key hash.
+	uint32_t hash;
+	// The decaying sample count.
+	uint32_t count;
+	// The number of lookups served by the replica.
+	uint64_t hits;
+	// The replicated entry and its stamp.
+	struct mc_entry *entry;
+	uint64_t stamp;
+};
+
+// Per-core hot key data.
+struct mc_hotkey_core
+{
+	// The number of lookups left until the next sample.
+	uint32_t countdown;
+
+	// Core-local read replicas require thread-safe entry reference
+	// counts so they are only made with locking table access.
+	bool replicas;
+
+	// Statistics.
+	uint64_t nsamples;
+	uint64_t nreplicas;
+	uint64_t ninvalid;
+
+	struct mc_hotkey_slot slots[MC_HOTKEY_SLOTS];
+};
+
+static MM_CDATA(struct mc_hotkey_core, mc_hotkey_data);
+
+/**********************************************************************
+ * Helper routines.
+ **********************************************************************/
+
+static inline struct mc_hotkey_core *
+mc_hotkey_core(void)
+{
+	return MM_CDATA_DEREF(mm_core_selfid(), mc_hotkey_data);
+}
+
+static inline struct mc_hotkey_slot *
+mc_hotkey_slot(struct mc_hotkey_core *data, uint32_t hash)
+{
+	// The low hash bits select table partitions and buckets so take
+	// the high ones.
+	return &data->slots[(hash >> 16) % MC_HOTKEY_SLOTS];
+}
+
+static bool
+mc_hotkey_match(struct mc_action *action, struct mc_entry *entry)
+{
+	if (action->key_len != entry->key_len)
+		return false;
+	return !memcmp(action->key, mc_entry_getkey(entry), action->key_len);
+}
+
+static bool
+mc_hotkey_valid(struct mc_action *action, struct mc_hotkey_slot *slot)
+{
+	struct mc_entry *entry = slot->entry;
+
+	// The entry gets unlinked from the table as soon as it is replaced
+	// or deleted. It cannot be reused while the replica refers to it.
+	uint8_t state = mm_memory_load(entry->state);
+	if (state < MC_ENTRY_USED_MIN || state > MC_ENTRY_USED_MAX)
+		return false;
+	if (entry->stamp != slot->stamp)
+		return false;
+
+	// Check for flush and expiration.
+	if (entry->stamp < mm_atomic_uint64_load(&action->part->flush_stamp))
+		return false;
+	if (entry->exp_time && entry->exp_time <= mc_table_time())
+		return false;
+
+	return true;
+}
+
+static void
+mc_hotkey_drop(struct mc_hotkey_slot *slot)
+{
+	if (slot->entry != NULL) {
+		struct mc_action action;
+		action.part = mc_table_part(slot->entry->hash);
+		action.old_entry = slot->entry;
+		mc_action_finish(&action);
+		slot->entry = NULL;
+	}
+}
+
+/**********************************************************************
+ * Hot key data initialization and termination.
+ **********************************************************************/
+
+void
+mc_hotkey_start(void)
+{
+	ENTER();
+
+	MM_CDATA_ALLOC(mm_domain_self(), "memcache hot keys", mc_hotkey_data);
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_hotkey_core *data = MM_CDATA_DEREF(core, mc_hotkey_data);
+		memset(data, 0, sizeof(struct mc_hotkey_core));
+		data->countdown = MC_HOTKEY_SAMPLE_RATE;
+		data->replicas = (mc_table.access == MC_ACCESS_LOCKING);
+	}
+
+	LEAVE();
+}
+
+void
+mc_hotkey_stop(void)
+{
+	ENTER();
+
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_hotkey_core *data = MM_CDATA_DEREF(core, mc_hotkey_data);
+		for (int i = 0; i < MC_HOTKEY_SLOTS; i++)
+			mc_hotkey_drop(&data->slots[i]);
+	}
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Hot key lookup and sampling.
+ **********************************************************************/
+
+bool
+mc_hotkey_lookup(struct mc_action *action)
+{
+	ENTER();
+	bool rc = false;
+
+	struct mc_hotkey_core *data = mc_hotkey_core();
+	struct mc_hotkey_slot *slot = mc_hotkey_slot(data, action->hash);
+	struct mc_entry *entry = slot->entry;
+	if (entry == NULL || slot->hash != action->hash)
+		goto leave;
+	if (!mc_hotkey_match(action, entry))
+		goto leave;
+
+	if (!mc_hotkey_valid(action, slot)) {
+		mc_hotkey_drop(slot);
+		data->ninvalid++;
+		goto leave;
+	}
+
+	// Bump the CLOCK state without the partition lock. The CAS fails
+	// if the entry gets unlinked meanwhile so it is never revived.
+	uint8_t state = mm_memory_load(entry->state);
+	while (state >= MC_ENTRY_USED_MIN && state < MC_ENTRY_USED_MAX) {
+		uint8_t prev = mm_atomic_uint8_cas(&entry->state, state, state + 1);
+		if (prev == state)
+			break;
+		state = prev;
+	}
+
+	action->old_entry = entry;
+	slot->hits++;
+	rc = true;
+
+leave:
+	LEAVE();
+	return rc;
+}
+
+void
+mc_hotkey_sample(struct mc_action *action)
+{
+	struct mc_hotkey_core *data = mc_hotkey_core();
+	if (likely(--data->countdown != 0))
+		return;
+
+	ENTER();
+
+	data->countdown = MC_HOTKEY_SAMPLE_RATE;
+	data->nsamples++;
+
+	struct mc_hotkey_slot *slot = mc_hotkey_slot(data, action->hash);
+	if (slot->count == 0) {
+		// Take over a cold slot.
+		mc_hotkey_drop(slot);
+		slot->hash = action->hash;
+		slot->count = 1;
+		slot->hits = 0;
+	} else if (slot->hash == action->hash) {
+		if (slot->count < MC_HOTKEY_COUNT_MAX)
+			slot->count++;
+	} else {
+		// Let the current slot key cool down.
+		slot->count--;
+	}
+
+	// Make a replica for a hot key.
+	struct mc_entry *entry = action->old_entry;
+	if (data->replicas
+	    && slot->count >= MC_HOTKEY_THRESHOLD
+	    && slot->hash == action->hash
+	    && slot->entry == NULL
+	    && entry != NULL
+	    && mm_memory_load(entry->state) >= MC_ENTRY_USED_MIN
+	    && mc_entry_ref_shared_live(entry)) {
+		// Skip entries that are removed or already retired.
+		slot->entry = entry;
+		slot->stamp = entry->stamp;
+		data->nreplicas++;
+	}
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Hot key statistics.
+ **********************************************************************/
+
+void
+mc_hotkey_stats(struct mm_netbuf_socket *sock)
+{
+	ENTER();
+
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		struct mc_hotkey_core *data = MM_CDATA_DEREF(core, mc_hotkey_data);
+		mm_netbuf_printf(sock,
+				 "STAT hotkey:%u:samples %llu\r\n"
+				 "STAT hotkey:%u:replicas %llu\r\n"
+				 "STAT hotkey:%u:invalidated %llu\r\n",
+				 core, (unsigned long long) data->nsamples,
+				 core, (unsigned long long) data->nreplicas,
+				 core, (unsigned long long) data->ninvalid);
+
+		for (int i = 0; i < MC_HOTKEY_SLOTS; i++) {
+			struct mc_hotkey_slot *slot = &data->slots[i];
+			if (slot->count < MC_HOTKEY_THRESHOLD)
+				continue;
+			mm_netbuf_printf(sock,
+					 "STAT hotkey:%u:%08x count %u hits %llu\r\n",
+					 core, slot->hash, slot->count,
+					 (unsigned long long) slot->hits);
+		}
+	}
+
+	LEAVE();
+}
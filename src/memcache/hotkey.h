@@ -0,0 +1,57 @@
+/*
+ * memcache/hotkey.h - MainMemory memcache hot key detection.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMCACHE_HOTKEY_H
+#define MEMCACHE_HOTKEY_H
+
+#include "memcache/memcache.h"
+
+/* Forward declarations. */
+struct mc_action;
+struct mm_netbuf_socket;
+
+/*
+ * Every so many lookups on a core the looked up key is sampled. A key that
+ * is sampled often enough on a core is considered hot. With table locking
+ * a hot key gets a core-local read replica that references the table entry
+ * so subsequent lookups on this core bypass the table partition entirely.
+ * The replica is dropped as soon as the entry is replaced, deleted, expired
+ * or flushed.
+ */
+
+/* Sample one of that many lookups. */
+#define MC_HOTKEY_SAMPLE_RATE	(32)
+/* The number of per-core hot key slots. */
+#define MC_HOTKEY_SLOTS		(32)
+/* The sample count that makes a key hot. */
+#define MC_HOTKEY_THRESHOLD	(8)
+
+void mc_hotkey_start(void);
+void mc_hotkey_stop(void);
+
+bool mc_hotkey_lookup(struct mc_action *action)
+	__attribute__((nonnull(1)));
+
+void mc_hotkey_sample(struct mc_action *action)
+	__attribute__((nonnull(1)));
+
+void mc_hotkey_stats(struct mm_netbuf_socket *sock)
+	__attribute__((nonnull(1)));
+
+#endif /* MEMCACHE_HOTKEY_H */
@@ -20,6 +20,9 @@
 #include "memcache/memcache.h"
 #include "memcache/command.h"
 #include "memcache/entry.h"
+#include "memcache/epoch.h"
+#include "memcache/flow.h"
+#include "memcache/hotkey.h"
 #include "memcache/parser.h"
 #include "memcache/state.h"
 #include "memcache/table.h"
@@ -29,13 +32,18 @@
 #include "core/pool.h"
 
 #include "base/bitops.h"
+#include "core/combiner.h"
 #include "base/list.h"
+#include "base/lock.h"
 #include "base/log/trace.h"
 #include "base/mem/alloc.h"
 #include "base/mem/chunk.h"
 
 #define MC_VERSION	"VERSION " PACKAGE_STRING "\r\n"
 
+// The number of the most contended locks to report.
+#define MC_LOCK_STATS_TOP	8
+
 struct mm_memcache_config mc_config;
 
 /**********************************************************************
@@ -43,13 +51,93 @@ struct mm_memcache_config mc_config;
  **********************************************************************/
 
 static void
-mc_transmit_unref(uintptr_t data)
+mc_transmit_unpin(uintptr_t data)
+{
+	ENTER();
+
+	mc_epoch_unpin((uint32_t) data);
+
+	LEAVE();
+}
+
+static void
+mc_transmit_combiner_stats(struct mc_state *state)
+{
+	ENTER();
+
+	for (mm_core_t p = 0; p < mc_table.nparts; p++) {
+		struct mm_task_combiner *combiner = mc_table.parts[p].combiner;
+		if (combiner == NULL)
+			continue;
+
+		struct mm_combiner_stat *stat = &combiner->combiner.stat;
+		mm_netbuf_printf(&state->sock,
+				 "STAT combiner:%u:passes %llu\r\n"
+				 "STAT combiner:%u:requests %llu\r\n"
+				 "STAT combiner:%u:batch_avg %.2f\r\n"
+				 "STAT combiner:%u:batch_max %llu\r\n"
+				 "STAT combiner:%u:handoffs %llu\r\n",
+				 p, (unsigned long long) stat->npasses,
+				 p, (unsigned long long) stat->nrequests,
+				 p, stat->npasses
+				 ? (double) stat->nrequests / stat->npasses : 0.0,
+				 p, (unsigned long long) stat->nbatch_max,
+				 p, (unsigned long long) stat->nhandoffs);
+#if ENABLE_LOCK_STATS
+		mm_netbuf_printf(&state->sock,
+				 "STAT combiner:%u:wait_time %llu\r\n",
+				 p, (unsigned long long) stat->wait_time);
+#endif
+	}
+
+	mm_netbuf_append(&state->sock, "END\r\n", 5);
+
+	LEAVE();
+}
+
+static void
+mc_transmit_lock_stats(struct mc_state *state)
 {
 	ENTER();
 
-	struct mc_action action;
-	action.old_entry = (struct mc_entry *) data;
-	mc_action_finish(&action);
+#if ENABLE_LOCK_STATS
+	struct mm_lock_stat_summary top[MC_LOCK_STATS_TOP];
+	size_t n = mm_lock_stat_top(top, MC_LOCK_STATS_TOP);
+	for (size_t i = 0; i < n; i++) {
+		struct mm_lock_stat *stat = &top[i].stat;
+		if (top[i].moreinfo != NULL)
+			mm_netbuf_printf(&state->sock, "STAT lock:%zu:location %s (%s)\r\n",
+					 i, top[i].location, top[i].moreinfo);
+		else
+			mm_netbuf_printf(&state->sock, "STAT lock:%zu:location %s\r\n",
+					 i, top[i].location);
+		mm_netbuf_printf(&state->sock,
+				 "STAT lock:%zu:locked %llu\r\n"
+				 "STAT lock:%zu:failed %llu\r\n"
+				 "STAT lock:%zu:wait_time %llu\r\n"
+				 "STAT lock:%zu:hold_time %llu\r\n",
+				 i, (unsigned long long) stat->lock_count,
+				 i, (unsigned long long) stat->fail_count,
+				 i, (unsigned long long) stat->wait_time,
+				 i, (unsigned long long) stat->hold_time);
+
+		mm_netbuf_printf(&state->sock, "STAT lock:%zu:wait_hist", i);
+		for (int b = 0; b < MM_LOCK_STAT_HIST; b++) {
+			if (stat->wait_hist[b])
+				mm_netbuf_printf(&state->sock, " %d:%llu", b,
+						 (unsigned long long) stat->wait_hist[b]);
+		}
+		mm_netbuf_printf(&state->sock, "\r\nSTAT lock:%zu:hold_hist", i);
+		for (int b = 0; b < MM_LOCK_STAT_HIST; b++) {
+			if (stat->hold_hist[b])
+				mm_netbuf_printf(&state->sock, " %d:%llu", b,
+						 (unsigned long long) stat->hold_hist[b]);
+		}
+		mm_netbuf_append(&state->sock, "\r\n", 2);
+	}
+#endif
+
+	mm_netbuf_append(&state->sock, "END\r\n", 5);
 
 	LEAVE();
 }
@@ -118,6 +206,24 @@ mc_transmit(struct mc_state *state, struct mc_command *command)
 		mm_netbuf_append(&state->sock, SL(MC_VERSION));
 		break;
 
+	case MC_RESULT_LOCK_STATS:
+		mc_transmit_lock_stats(state);
+		break;
+
+	case MC_RESULT_HOTKEY_STATS:
+		mc_hotkey_stats(&state->sock);
+		mm_netbuf_append(&state->sock, SL("END\r\n"));
+		break;
+
+	case MC_RESULT_FLOW_STATS:
+		mc_flow_stats(&state->sock);
+		mm_netbuf_append(&state->sock, SL("END\r\n"));
+		break;
+
+	case MC_RESULT_COMBINER_STATS:
+		mc_transmit_combiner_stats(state);
+		break;
+
 #undef SL
 
 	case MC_RESULT_ENTRY:
@@ -143,11 +249,10 @@ mc_transmit(struct mc_state *state, struct mc_command *command)
 				(unsigned long long) entry->stamp);
 		}
 
+		// Keep the epoch pinned until the value is written.
 		mm_netbuf_splice(&state->sock, value, value_len,
-				 mc_transmit_unref, (uintptr_t) entry);
-
-		// Prevent extra entry unref on command destruction.
-		command->result = MC_RESULT_BLANK;
+				 mc_transmit_unpin, command->epoch);
+		command->pinned = false;
 
 		if (command->params.last)
 			mm_netbuf_append(&state->sock, "\r\nEND\r\n", 7);
@@ -161,11 +266,10 @@ mc_transmit(struct mc_state *state, struct mc_command *command)
 		char *value = mc_entry_getvalue(entry);
 		uint32_t value_len = entry->value_len;
 
+		// Keep the epoch pinned until the value is written.
 		mm_netbuf_splice(&state->sock, value, value_len,
-				 mc_transmit_unref, (uintptr_t) entry);
-
-		// Prevent extra entry unref on command destruction.
-		command->result = MC_RESULT_BLANK;
+				 mc_transmit_unpin, command->epoch);
+		command->pinned = false;
 
 		mm_netbuf_append(&state->sock, "END\r\n", 5);
 		break;
@@ -182,7 +286,7 @@ mc_transmit(struct mc_state *state, struct mc_command *command)
 	LEAVE();
 }
 
-static void
+static ssize_t
 mc_transmit_flush(struct mc_state *state)
 {
 	ENTER();
@@ -191,7 +295,15 @@ mc_transmit_flush(struct mc_state *state)
 	if (n > 0)
 		mm_netbuf_write_reset(&state->sock);
 
+	// A slow client must not pin the current epoch until it reads all
+	// the pending values as this would stall entry reclamation for all
+	// the clients. So if the socket could not take the results at once
+	// then copy the values still referenced by the buffer and unpin.
+	if (!mm_netbuf_write_empty(&state->sock))
+		mm_netbuf_unsplice(&state->sock, mc_transmit_unpin);
+
 	LEAVE();
+	return n;
 }
 
 /**********************************************************************
@@ -205,6 +317,7 @@ mc_process_command(struct mc_state *state, struct mc_command *first)
 {
 	ENTER();
  
+	uint32_t n = 1;
 	struct mc_command *last = first;
 	if (likely(first->type != NULL)) {
 		DEBUG("command %s", mc_command_name(first->type->tag));
@@ -213,11 +326,12 @@ mc_process_command(struct mc_state *state, struct mc_command *first)
 			if (last->next == NULL)
 				break;
 			last = last->next;
+			n++;
 		}
 	}
 
 	mc_queue_command(state, first, last);
-	mm_net_spawn_writer(&state->sock.sock);
+	mc_flow_enqueue(n);
 
 	LEAVE();
 	return 0;
@@ -251,6 +365,30 @@ mc_release_buffers(struct mc_state *state, char *ptr)
 	LEAVE();
 }
 
+// Adjust the read size to the connection traffic. Grow it for bulk
+// senders and shrink it back for the others.
+static void
+mc_reader_adjust(struct mc_state *state, ssize_t n)
+{
+	if ((size_t) n >= state->read_size) {
+		if (state->read_size < MC_READ_SIZE_MAX)
+			state->read_size *= 2;
+	} else if ((size_t) n < state->read_size / 4) {
+		if (state->read_size > MC_READ_SIZE_MIN)
+			state->read_size /= 2;
+	}
+}
+
+static ssize_t
+mc_reader_read(struct mc_state *state)
+{
+	mm_netbuf_demand(&state->sock, state->read_size);
+	ssize_t n = mm_netbuf_read(&state->sock);
+	if (n > 0)
+		mc_reader_adjust(state, n);
+	return n;
+}
+
 static void
 mc_reader_routine(struct mm_net_socket *sock)
 {
@@ -266,10 +404,13 @@ mc_reader_routine(struct mm_net_socket *sock)
 
 	// Try to get some input w/o blocking.
 	mm_net_set_read_timeout(&state->sock.sock, 0);
-	mm_netbuf_demand(&state->sock, 1);
-	ssize_t n = mm_netbuf_read(&state->sock);
+	ssize_t n = mc_reader_read(state);
 	mm_net_set_read_timeout(&state->sock.sock, MC_READ_TIMEOUT);
 
+	// Initialize the processing budget.
+	struct mc_flow_budget budget;
+	mc_flow_budget_reset(&budget);
+
 retry:
 	// Get out of here if there is no more input available.
 	if (n <= 0) {
@@ -286,12 +427,16 @@ retry:
 		}
 		goto leave;
 	}
+	mc_flow_charge_bytes(&budget, n);
 
 	// Initialize the parser.
 	struct mc_parser parser;
 	mc_parser_start(&parser, state);
 
 parse:
+	// Give way to the other connections if needed.
+	mc_flow_control(state, &budget);
+
 	// Try to parse the received input.
 	if (!mc_parser_parse(&parser)) {
 		if (parser.command != NULL) {
@@ -303,9 +448,10 @@ parse:
 			goto leave;
 		}
 
-		// The input is incomplete, try to get some more.
-		mm_netbuf_demand(&state->sock, 1);
-		n = mm_netbuf_read(&state->sock);
+		// The input is incomplete, try to get some more. Let the
+		// results of the batch go out before waiting for input.
+		mc_start_writer(state);
+		n = mc_reader_read(state);
 		goto retry;
 	}
 
@@ -314,6 +460,7 @@ parse:
 
 	// Process the parsed command.
 	mc_process_command(state, parser.command);
+	mc_flow_charge_command(&budget);
 
 	// If there is more input in the buffer then try to parse the next
 	// command.
@@ -321,6 +468,16 @@ parse:
 		goto parse;
 
 leave:
+	// Transmit the results of the whole batch at once.
+	mc_start_writer(state);
+
+	// Don't hold the receive buffer memory while the connection is idle.
+	if (state->command_head == NULL && mm_netbuf_read_empty(&state->sock)) {
+		mm_netbuf_read_release(&state->sock);
+		state->read_size = MC_READ_SIZE_MIN;
+		state->start_ptr = NULL;
+	}
+
 	LEAVE();
 }
 
@@ -333,10 +490,18 @@ mc_writer_routine(struct mm_net_socket *sock)
 
 	// Check to see if there at least one ready result.
 	struct mc_command *command = state->command_head;
-	if (unlikely(command == NULL))
+	if (unlikely(command == NULL)) {
+		// Transmit the results left over from previous runs.
+		if (!mm_netbuf_write_empty(&state->sock)) {
+			if (mc_transmit_flush(state) > 0)
+				mc_flow_written(0);
+			mc_flow_transmit(state, mm_netbuf_write_size(&state->sock));
+		}
 		goto leave;
+	}
 
 	// Put the results into the transmit buffer.
+	uint32_t n = 1;
 	for (;;) {
 		mc_transmit(state, command);
 
@@ -345,10 +510,15 @@ mc_writer_routine(struct mm_net_socket *sock)
 			break;
 
 		command = next;
+		n++;
 	}
 
 	// Transmit buffered results.
-	mc_transmit_flush(state);
+	if (mc_transmit_flush(state) > 0)
+		mc_flow_written(n);
+	mc_flow_transmit(state, mm_netbuf_write_size(&state->sock));
+	if (mm_netbuf_write_empty(&state->sock))
+		mm_netbuf_write_release(&state->sock);
 
 	// Free the receive buffers.
 	mc_release_buffers(state, command->end_ptr);
@@ -366,6 +536,7 @@ mc_writer_routine(struct mm_net_socket *sock)
 			break;
 		}
 	}
+	mc_flow_dequeue(n);
 
 leave:
 	LEAVE();
@@ -384,7 +555,9 @@ mc_memcache_start(void)
 	ENTER();
 
 	mc_table_init(&mc_config);
-	mc_command_start();
+	mc_hotkey_start();
+	mc_flow_start();
+	mc_command_start(&mc_config);
 	mm_net_start_server(mc_tcp_server);
 
 	LEAVE();
@@ -397,6 +570,7 @@ mc_memcache_stop(void)
 
 	mm_net_stop_server(mc_tcp_server);
 	mc_command_stop();
+	mc_hotkey_stop();
 	mc_table_term();
 
 	LEAVE();
@@ -417,8 +591,17 @@ mm_memcache_init(const struct mm_memcache_config *config)
 		.writer = mc_writer_routine,
 	};
 
+	const char *addr = MC_ADDR_DEFAULT;
+	uint16_t port = MC_PORT_DEFAULT;
+	if (config != NULL && config->addr != NULL)
+		addr = config->addr;
+	if (config != NULL && config->port)
+		port = config->port;
+
 	mc_tcp_server = mm_net_create_inet_server("memcache", &proto,
-						  "127.0.0.1", 11211);
+						  addr, port);
+	if (config != NULL && mm_bitset_any(&config->net_affinity))
+		mm_net_set_server_affinity(mc_tcp_server, &config->net_affinity);
 
 	mm_core_hook_start(mc_memcache_start);
 	mm_core_hook_stop(mc_memcache_stop);
@@ -429,19 +612,37 @@ mm_memcache_init(const struct mm_memcache_config *config)
 	else
 		mc_config.volume = MC_TABLE_VOLUME_DEFAULT;
 
-	// Determine the required memcache table partitions.
-#if ENABLE_MEMCACHE_DELEGATE
-	mm_bitset_prepare(&mc_config.affinity, &mm_alloc_global, mm_core_getnum());
+	// Determine the table access method.
+	if (config != NULL) {
+		mc_config.access = config->access;
+		mc_config.delegate_futures = config->delegate_futures;
+	} else {
+		mc_config.access = MC_ACCESS_DEFAULT;
+	}
+
+	// Determine if entries are indexed by expiration time.
 	if (config != NULL)
-		mm_bitset_or(&mc_config.affinity, &config->affinity);
-	if (!mm_bitset_any(&mc_config.affinity))
-		mm_bitset_set(&mc_config.affinity, 0);
-#else
-	if (config != NULL && config->nparts)
-		mc_config.nparts = config->nparts;
-	else
-		mc_config.nparts = 1;
-#endif
+		mc_config.expiry_wheel = config->expiry_wheel;
+	// Determine if combiner batches are ordered by table buckets.
+	if (config != NULL)
+		mc_config.combiner_sort = config->combiner_sort;
+	// Determine if combiner waiters spin or block.
+	if (config != NULL)
+		mc_config.combiner_spin = config->combiner_spin;
+
+	// Determine the required memcache table partitions.
+	if (mc_config.access == MC_ACCESS_DELEGATE) {
+		mm_bitset_prepare(&mc_config.affinity, &mm_global_arena, mm_core_getnum());
+		if (config != NULL)
+			mm_bitset_or(&mc_config.affinity, &config->affinity);
+		if (!mm_bitset_any(&mc_config.affinity))
+			mm_bitset_set(&mc_config.affinity, 0);
+	} else {
+		if (config != NULL && config->nparts)
+			mc_config.nparts = config->nparts;
+		else
+			mc_config.nparts = 1;
+	}
 
 	LEAVE();
 }
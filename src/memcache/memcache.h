@@ -23,44 +23,65 @@
 #include "common.h"
 #include "base/bitset.h"
 
-/* Enable table access combiner. */
-#define ENABLE_MEMCACHE_COMBINER	0
-/* Enable table access via delegate thread. */
-#define ENABLE_MEMCACHE_DELEGATE	0
-/* Enable table access with locking. */
-#define ENABLE_MEMCACHE_LOCKING		0
-
 #ifndef mc_hash
 # define mc_hash			mm_hash_murmur3_32
 #endif
 
+/* The server address and port by default. */
+#define MC_ADDR_DEFAULT			"127.0.0.1"
+#define MC_PORT_DEFAULT			11211
+
 /* Maximum total data size by default. */
 #define MC_TABLE_VOLUME_DEFAULT		(64 * 1024 * 1024)
 
 #define MC_COMBINER_SIZE		(1024)
-#define MC_COMBINER_HANDOFF		(16)
+#define MC_COMBINER_HANDOFF		(64)
+
+/* Memcache table access methods. */
+typedef enum
+{
+	/* Table access with locking. */
+	MC_ACCESS_LOCKING,
+	/* Table access combiner. */
+	MC_ACCESS_COMBINER,
+	/* Table access via delegate thread. */
+	MC_ACCESS_DELEGATE,
+
+} mc_access_t;
 
-/* Sanity checks for requested table access method. */
-#if (ENABLE_MEMCACHE_COMBINER && ENABLE_MEMCACHE_DELEGATE)	\
- || (ENABLE_MEMCACHE_COMBINER && ENABLE_MEMCACHE_LOCKING)	\
- || (ENABLE_MEMCACHE_DELEGATE && ENABLE_MEMCACHE_LOCKING)
-# error "Ambiguous memcache table access method."
-#endif
 /* Use locking by default. */
-#if !ENABLE_MEMCACHE_COMBINER && !ENABLE_MEMCACHE_DELEGATE
-# undef ENABLE_MEMCACHE_LOCKING
-# define ENABLE_MEMCACHE_LOCKING	1
-#endif
+#define MC_ACCESS_DEFAULT		MC_ACCESS_LOCKING
 
 struct mm_memcache_config
 {
+	/* The server address and port. */
+	const char *addr;
+	uint16_t port;
+	/* The cores that handle server connections. */
+	struct mm_bitset net_affinity;
+
+	/* Maximum total data size. */
 	size_t volume;
 
-#if ENABLE_MEMCACHE_DELEGATE
-	struct mm_bitset affinity;
-#else
+	/* The table access method. */
+	mc_access_t access;
+
+	/* The number of table partitions for locking and combiner
+	   access. */
 	mm_core_t nparts;
-#endif
+	/* The cores that own table partitions for delegate access. */
+	struct mm_bitset affinity;
+	/* Use futures rather than request rings for delegate access. */
+	bool delegate_futures;
+
+	/* Index entries by expiration time to drop them right on time. */
+	bool expiry_wheel;
+
+	/* Execute combiner batches in the order of table buckets. */
+	bool combiner_sort;
+	/* Spin while waiting for the combiner rather than let other
+	   tasks run. */
+	bool combiner_spin;
 };
 
 void mm_memcache_init(const struct mm_memcache_config *config);
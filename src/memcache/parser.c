@@ -131,6 +131,21 @@ mc_parser_scan_value(struct mc_parser *parser)
 	return rc;
 }
 
+// Remember the first stats option chars.
+static void
+mc_parser_option_char(struct mc_command *command, int c)
+{
+	if (command->type != NULL
+	    && command->type->tag == mc_command_stats
+	    && command->params.stats.nopts == 0) {
+		struct mc_command_params_stats *stats = &command->params.stats;
+		if (stats->option_len < MC_STATS_OPTION_SIZE)
+			stats->option[stats->option_len] = c;
+		if (stats->option_len <= MC_STATS_OPTION_SIZE)
+			stats->option_len++;
+	}
+}
+
 // TODO: Really support some options.
 static void
 mc_parser_handle_option(struct mc_command *command)
@@ -752,7 +767,7 @@ again:
 					state = S_EOL;
 					goto again;
 				} else {
-					// TODO: add c to the option value
+					mc_parser_option_char(command, c);
 					state = S_OPT_N;
 					break;
 				}
@@ -769,7 +784,7 @@ again:
 					state = S_EOL;
 					goto again;
 				} else {
-					// TODO: add c to the option value
+					mc_parser_option_char(command, c);
 					break;
 				}
 
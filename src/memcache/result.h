@@ -25,9 +25,8 @@
 typedef enum
 {
 	MC_RESULT_NONE = 0,
-#if ENABLE_MEMCACHE_DELEGATE
 	MC_RESULT_FUTURE,
-#endif
+	MC_RESULT_REQUEST,
 
 	MC_RESULT_BLANK,
 	MC_RESULT_OK,
@@ -43,6 +42,10 @@ typedef enum
 	MC_RESULT_NOT_IMPLEMENTED,
 	MC_RESULT_CANCELED,
 	MC_RESULT_VERSION,
+	MC_RESULT_LOCK_STATS,
+	MC_RESULT_HOTKEY_STATS,
+	MC_RESULT_FLOW_STATS,
+	MC_RESULT_COMBINER_STATS,
 
 	MC_RESULT_ENTRY,
 	MC_RESULT_ENTRY_CAS,
@@ -18,6 +18,7 @@
  */
 
 #include "memcache/state.h"
+#include "memcache/flow.h"
 
 struct mm_net_socket *
 mc_state_alloc(void)
@@ -49,15 +50,21 @@ mc_state_prepare(struct mm_net_socket *sock)
 
 	struct mc_state *state = containerof(sock, struct mc_state, sock);
 
+	state->read_size = MC_READ_SIZE_MIN;
 	state->start_ptr = NULL;
 
 	state->command_head = NULL;
 	state->command_tail = NULL;
 
+	state->tbuf_size = 0;
+	mm_waitset_prepare(&state->drain_waitset);
+	mm_waitset_pin(&state->drain_waitset, sock->event.core);
+
 	mm_netbuf_prepare(&state->sock);
 
 	state->error = false;
 	state->trash = false;
+	state->throttled = false;
 
 	LEAVE();
 }
@@ -73,8 +80,12 @@ mc_state_cleanup(struct mm_net_socket *sock)
 		struct mc_command *command = state->command_head;
 		state->command_head = command->next;
 		mc_command_destroy(sock->event.core, command);
+		mc_flow_dequeue(1);
 	}
 
+	mc_flow_transmit(state, 0);
+	mm_waitset_cleanup(&state->drain_waitset);
+
 	mm_netbuf_cleanup(&state->sock);
 
 	LEAVE();
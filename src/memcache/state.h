@@ -22,14 +22,23 @@
 
 #include "memcache/command.h"
 
+#include "core/wait.h"
+
 #include "base/log/trace.h"
 #include "net/netbuf.h"
 
+/* The adaptive read size limits. */
+#define MC_READ_SIZE_MIN	(1024)
+#define MC_READ_SIZE_MAX	(64 * 1024)
+
 struct mc_state
 {
 	// The client socket,
 	struct mm_netbuf_socket sock;
 
+	// The amount of input to read at once.
+	uint32_t read_size;
+
 	// Current parse position.
 	char *start_ptr;
 	// Last processed position.
@@ -39,9 +48,15 @@ struct mc_state
 	struct mc_command *command_head;
 	struct mc_command *command_tail;
 
+	// The transmit buffer size as of the last writer run.
+	size_t tbuf_size;
+	// The reader waiting for the transmit buffer drain.
+	struct mm_waitset drain_waitset;
+
 	// Flags.
 	bool error;
 	bool trash;
+	bool throttled;
 };
 
 /* Net-proto routines. */
@@ -69,4 +84,16 @@ mc_queue_command(struct mc_state *state,
 	LEAVE();
 }
 
+/*
+ * The reader does not transmit the results of each command right away.
+ * Instead it starts the writer at the end of a batch of pipelined commands
+ * so that all the batch results are transmitted with a single system call.
+ */
+static inline void
+mc_start_writer(struct mc_state *state)
+{
+	if (state->command_head != NULL)
+		mm_net_spawn_writer(&state->sock.sock);
+}
+
 #endif /* MEMCACHE_STATE_H */
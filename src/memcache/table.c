@@ -20,11 +20,15 @@
 #include "memcache/table.h"
 #include "memcache/action.h"
 #include "memcache/entry.h"
+#include "memcache/epoch.h"
 
 #include "core/task.h"
 
-#include "base/combiner.h"
+#include "core/combiner.h"
 #include "base/hash.h"
+#include "base/mem/cdata.h"
+#include "base/sys/clock.h"
+#include "base/thr/domain.h"
 #include "base/log/error.h"
 #include "base/log/plain.h"
 #include "base/log/trace.h"
@@ -38,9 +42,25 @@
 #endif
 
 #define MC_TABLE_VOLUME_RESERVE	(64 * 1024)
+// The number of spare entries to keep per partition once it cannot expand.
+#define MC_TABLE_ENTRIES_RESERVE	(1024)
+
+// The minimal time between volume rebalancing attempts.
+#define MC_TABLE_REBALANCE_INTERVAL	(100 * 1000)
+// The limits for partition volume relative to its initial share.
+#define MC_TABLE_REBALANCE_GROWTH	4
+#define MC_TABLE_REBALANCE_SHRINK	4
+// The volume moved at once relative to the initial partition share.
+#define MC_TABLE_REBALANCE_STEP		16
+
+// The number of stamp bits for the sequence within a microsecond.
+#define MC_TABLE_STAMP_SEQ_BITS		8
 
 struct mc_table mc_table;
 
+// The last stamp value used by each core.
+static MM_CDATA(uint64_t, mc_table_stamps);
+
 /**********************************************************************
  * Helper routines.
  **********************************************************************/
@@ -59,6 +79,21 @@ mc_table_entries_size(uint16_t nparts, uint32_t nentries)
 	return nparts * mm_round_up(space, MM_PAGE_SIZE);
 }
 
+static const char *
+mc_table_access_name(mc_access_t access)
+{
+	switch (access) {
+	case MC_ACCESS_LOCKING:
+		return "locking";
+	case MC_ACCESS_COMBINER:
+		return "combiner";
+	case MC_ACCESS_DELEGATE:
+		return "delegate";
+	default:
+		ABORT();
+	}
+}
+
 static inline bool
 mc_table_check_size(struct mc_tpart *part)
 {
@@ -72,8 +107,79 @@ mc_table_check_size(struct mc_tpart *part)
 static inline bool
 mc_table_check_volume(struct mc_tpart *part, size_t reserve)
 {
-	uint32_t n = mm_memory_load(part->volume);
-	return (n + reserve) > mc_table.volume_max;
+	size_t n = mm_memory_load(part->volume);
+	n += mm_memory_load(part->volume_retired);
+	return (n + reserve) > mm_memory_load(part->volume_max);
+}
+
+// Check if the partition is short of entries for creation. The retired
+// entries count as spare as they become free after the epoch advances.
+static inline bool
+mc_table_check_entries(struct mc_tpart *part, uint32_t reserve)
+{
+	uint32_t n = mm_memory_load(part->nentries_free);
+	n += mm_memory_load(part->nentries_void);
+	n += mm_memory_load(part->nentries_retired);
+	return n < reserve && mm_memory_load(part->nentries) >= mc_table.nentries_max;
+}
+
+/**********************************************************************
+ * Entry stamps.
+ **********************************************************************/
+
+static inline uint64_t
+mc_table_stamp_time(void)
+{
+	mm_timeval_t time = mm_clock_gettime_monotonic() - mc_table.stamp_base;
+	return (uint64_t) time << MC_TABLE_STAMP_SEQ_BITS;
+}
+
+uint64_t
+mc_table_stamp(void)
+{
+	mm_core_t core = mm_core_selfid();
+	uint64_t *last = MM_CDATA_DEREF(core, mc_table_stamps);
+
+	// If the sequence overflows the stamps of this core run ahead of
+	// time for a while. With 256 stamps per microsecond this does not
+	// really happen.
+	uint64_t value = mc_table_stamp_time();
+	if (value <= *last)
+		value = *last + 1;
+	*last = value;
+
+	return (value << mc_table.stamp_core_bits) | core;
+}
+
+uint64_t
+mc_table_flush_stamp(void)
+{
+	// Take the next microsecond unless some core has run ahead of it.
+	uint64_t value = mc_table_stamp_time() >> MC_TABLE_STAMP_SEQ_BITS;
+	value = (value + 1) << MC_TABLE_STAMP_SEQ_BITS;
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+		uint64_t last = mm_memory_load(*MM_CDATA_DEREF(core, mc_table_stamps));
+		if (value <= last)
+			value = last + 1;
+	}
+
+	return value << mc_table.stamp_core_bits;
+}
+
+static void
+mc_table_init_stamps(void)
+{
+	// Start one microsecond back so that all stamps are non-zero.
+	mc_table.stamp_base = mm_clock_gettime_monotonic() - 1;
+
+	uint16_t bits = 0;
+	while ((1u << bits) < mm_core_getnum())
+		bits++;
+	mc_table.stamp_core_bits = bits;
+
+	MM_CDATA_ALLOC(mm_domain_self(), "memcache stamps", mc_table_stamps);
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++)
+		*MM_CDATA_DEREF(core, mc_table_stamps) = 0;
 }
 
 /**********************************************************************
@@ -197,12 +303,113 @@ mc_table_start_striding(struct mc_tpart *part)
 {
 	ENTER();
 
-#if ENABLE_MEMCACHE_DELEGATE
-	mm_core_post(MM_CORE_SELF, mc_table_stride_routine, (mm_value_t) part);
-#else
-	mm_core_post(MM_CORE_NONE, mc_table_stride_routine, (mm_value_t) part);
-#endif
+	// With delegate access the routine has to run on the partition
+	// owner core, otherwise on any core.
+	mm_core_post(part->core, mc_table_stride_routine, (mm_value_t) part);
+
+	LEAVE();
+}
+
+/**********************************************************************
+ * Volume rebalancing.
+ **********************************************************************/
+
+// Get the hit density of a partition since the last rebalancing.
+static uint64_t
+mc_table_hits(struct mc_tpart *part)
+{
+	uint64_t hits = 0;
+	for (mm_core_t core = 0; core < mm_core_getnum(); core++)
+		hits += mm_memory_load(*MM_CDATA_DEREF(core, part->nhits));
+	return hits;
+}
+
+static double
+mc_table_hit_density(struct mc_tpart *part, size_t volume_max)
+{
+	uint64_t hits = mc_table_hits(part) - part->nhits_last;
+	return (double) hits / volume_max;
+}
+
+// Find a partition that might give away some of its volume to another
+// partition under eviction pressure. Unused volume is taken first. If
+// there is none then take it from a partition that does not evict and
+// makes less use of its data.
+static struct mc_tpart *
+mc_table_find_donor(struct mc_tpart *recipient, size_t reserve)
+{
+	size_t step = mc_table.volume_step;
+	double density = mc_table_hit_density(recipient, mm_memory_load(recipient->volume_max));
+
+	struct mc_tpart *donor = NULL;
+	for (mm_core_t p = 0; p < mc_table.nparts; p++) {
+		struct mc_tpart *part = &mc_table.parts[p];
+		if (part == recipient)
+			continue;
+
+		size_t volume_max = mm_memory_load(part->volume_max);
+		if (volume_max < mc_table.volume_min + step)
+			continue;
 
+		size_t volume = mm_memory_load(part->volume);
+		volume += mm_memory_load(part->volume_retired);
+		if (volume + step + reserve <= volume_max)
+			return part;
+
+		if (mm_memory_load(part->nevicted) != part->nevicted_last)
+			continue;
+
+		double part_density = mc_table_hit_density(part, volume_max);
+		if (part_density < density) {
+			density = part_density;
+			donor = part;
+		}
+	}
+
+	return donor;
+}
+
+// Move some volume to a partition that has to evict entries. The donor
+// partition evicts its excess data on its own next insertion.
+static void
+mc_table_rebalance(struct mc_tpart *part, size_t reserve)
+{
+	ENTER();
+
+	if (mc_table.nparts == 1)
+		goto leave;
+
+	mm_timeval_t time = mm_core->time_manager.time;
+	if (time < mm_memory_load(mc_table.rebalance_time) + MC_TABLE_REBALANCE_INTERVAL)
+		goto leave;
+	if (!mm_task_trylock(&mc_table.rebalance_lock))
+		goto leave;
+	mm_memory_store(mc_table.rebalance_time, time);
+
+	size_t step = mc_table.volume_step;
+	size_t volume_max = mm_memory_load(part->volume_max);
+	if (volume_max + step <= mc_table.volume_cap) {
+		struct mc_tpart *donor = mc_table_find_donor(part, reserve);
+		if (donor != NULL) {
+			DEBUG("move %lu bytes from partition #%d to #%d",
+			      (unsigned long) step,
+			      (int) (donor - mc_table.parts),
+			      (int) (part - mc_table.parts));
+			mm_memory_store(donor->volume_max, donor->volume_max - step);
+			mm_memory_store(part->volume_max, volume_max + step);
+		}
+	}
+
+	// Start a new measurement period.
+	for (mm_core_t p = 0; p < mc_table.nparts; p++) {
+		struct mc_tpart *other = &mc_table.parts[p];
+		other->nhits_last = mc_table_hits(other);
+		other->nevicted_last = mm_memory_load(other->nevicted);
+	}
+
+	mm_task_unlock(&mc_table.rebalance_lock);
+
+leave:
 	LEAVE();
 }
 
@@ -221,9 +428,23 @@ mc_table_evict_routine(mm_value_t arg)
 	struct mc_action action;
 	action.part = part;
 
+	// Try to get more volume before evicting anything.
 	size_t reserve = MC_TABLE_VOLUME_RESERVE / mc_table.nparts;
-	while (mc_table_check_volume(part, reserve)) {
+	mc_table_rebalance(part, reserve);
+
+	while (mc_table_check_volume(part, reserve)
+	       || mc_table_check_entries(part, MC_TABLE_ENTRIES_RESERVE)) {
+		size_t volume = mm_memory_load(part->volume);
+		size_t volume_retired = mm_memory_load(part->volume_retired);
+
 		mc_action_evict(&action);
+
+		// Stop if nothing could be evicted or reclaimed. The next
+		// write starts over again.
+		if (volume == mm_memory_load(part->volume)
+		    && volume_retired == mm_memory_load(part->volume_retired))
+			break;
+
 		mm_task_yield();
 	}
 
@@ -238,11 +459,9 @@ mc_table_start_evicting(struct mc_tpart *part)
 {
 	ENTER();
 
-#if ENABLE_MEMCACHE_DELEGATE
-	mm_core_post(MM_CORE_SELF, mc_table_evict_routine, (mm_value_t) part);
-#else
-	mm_core_post(MM_CORE_NONE, mc_table_evict_routine, (mm_value_t) part);
-#endif
+	// With delegate access the routine has to run on the partition
+	// owner core, otherwise on any core.
+	mm_core_post(part->core, mc_table_evict_routine, (mm_value_t) part);
 
 	LEAVE();
 }
@@ -263,6 +482,13 @@ mc_table_reserve_entries(struct mc_tpart *part)
 		part->striding = true;
 		mc_table_start_striding(part);
 	}
+
+	// Evict ahead of demand so that the evicted entries are reclaimable
+	// by the time the free ones run out.
+	if (!part->evicting && mc_table_check_entries(part, MC_TABLE_ENTRIES_RESERVE / 2)) {
+		part->evicting = true;
+		mc_table_start_evicting(part);
+	}
 }
 
 /**********************************************************************
@@ -286,33 +512,59 @@ mc_table_init_part(mm_core_t index, mm_core_t core)
 	part->clock_hand = part->entries;
 
 	mm_link_init(&part->free_list);
+	mm_queue_init(&part->retired);
 
 	part->nbuckets = 0;
 	part->nbuckets = 0;
 	part->nentries_free = 0;
+	part->nentries_retired = 0;
 	part->nentries_void = 0;
 
 	part->volume = 0;
+	part->volume_retired = 0;
+	// Start with an equal volume share rounded to the rebalancing step.
+	part->volume_max = mc_table.volume_step * MC_TABLE_REBALANCE_STEP;
+
+	MM_CDATA_ALLOC(mm_domain_self(), "memcache table hits", part->nhits);
+	for (mm_core_t c = 0; c < mm_core_getnum(); c++)
+		*MM_CDATA_DEREF(c, part->nhits) = 0;
+	part->nevicted = 0;
+	part->nhits_last = 0;
+	part->nevicted_last = 0;
 
 	mm_waitset_prepare(&part->waitset);
 	mm_waitset_pin(&part->waitset, core);
 
-#if ENABLE_MEMCACHE_COMBINER
-	part->combiner = mm_combiner_create(mc_action_perform,
-					    MC_COMBINER_SIZE,
-					    MC_COMBINER_HANDOFF);
-#elif ENABLE_MEMCACHE_DELEGATE
-	mm_verbose("bind partition %d to core %d", index, core);
+	if (mc_table.access == MC_ACCESS_COMBINER) {
+		part->combiner = mm_task_combiner_create("memcache table partition",
+							 mc_action_perform,
+							 MC_COMBINER_SIZE,
+							 MC_COMBINER_HANDOFF);
+		if (mc_table.combiner_sort)
+			mm_combiner_set_sort(&part->combiner->combiner,
+					     mc_action_sort_key);
+	} else {
+		part->combiner = NULL;
+	}
+
+	if (core != MM_CORE_NONE)
+		mm_verbose("bind partition %d to core %d", index, core);
 	part->core = core;
-#elif ENABLE_MEMCACHE_LOCKING
-	part->lookup_lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
+
+	mm_task_rwlock_prepare(&part->lookup_lock, "memcache table partition");
 	part->freelist_lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
-#endif
 
 	part->evicting = false;
 	part->striding = false;
 
-	part->stamp = index;
+	part->flush_stamp = 0;
+
+	if (mc_table.expiry_wheel) {
+		part->wheel = mm_shared_alloc(sizeof(struct mc_wheel));
+		mc_wheel_prepare(part->wheel, mc_table_time());
+	} else {
+		part->wheel = NULL;
+	}
 
 	// Allocate initial space for the table.
 	mc_table_expand(part, mc_table.nentries_increment);
@@ -328,29 +580,39 @@ mc_table_init(const struct mm_memcache_config *config)
 
 	// Round the number of table partitions to a power of 2.
 	mm_core_t nparts;
-#if ENABLE_MEMCACHE_DELEGATE
-	nparts = mm_bitset_count(&config->affinity);
-#else
-	nparts = config->nparts;
-#endif
+	if (config->access == MC_ACCESS_DELEGATE)
+		nparts = mm_bitset_count(&config->affinity);
+	else
+		nparts = config->nparts;
 	ASSERT(nparts > 0);
 	uint16_t nbits = sizeof(int) * 8 - 1 - mm_clz(nparts);
 	nparts = 1 << nbits;
 
+	mm_brief("memcache table access: %s", mc_table_access_name(config->access));
 	mm_brief("memcache partitions: %d", nparts);
 	mm_brief("memcache partition bits: %d", nbits);
 
-	// Determine the size constraints for table partitions.
+	// Determine the size constraints for table partitions. Initially
+	// the volume is split equally but then it might be rebalanced to
+	// the partitions that need it more.
 	size_t volume = config->volume / nparts;
 	if (volume < MM_PAGE_SIZE)
 		volume = MM_PAGE_SIZE;
+	size_t volume_cap = volume;
+	if (nparts > 1) {
+		volume_cap *= MC_TABLE_REBALANCE_GROWTH;
+		if (volume_cap > config->volume)
+			volume_cap = config->volume;
+	}
 	// Make a very liberal estimate that for an average table entry
 	// the combined size of key and data might be as small as 20 bytes.
-	size_t nentries_max = volume / (sizeof(struct mc_entry) + 20);
+	size_t nentries_max = volume_cap / (sizeof(struct mc_entry) + 20);
 	size_t nbuckets_max = 1 << (sizeof(int) * 8 - 1 - mm_clz(nentries_max));
 
-	mm_brief("memcache maximum data volume per partition: %lu",
+	mm_brief("memcache initial data volume per partition: %lu",
 		 (unsigned long) volume);
+	mm_brief("memcache maximum data volume per partition: %lu",
+		 (unsigned long) volume_cap);
 	mm_brief("memcache maximum number of entries per partition: %lu",
 		 (unsigned long) nentries_max);
 	mm_brief("memcache maximum number of buckets per partition: %lu",
@@ -386,31 +648,41 @@ mc_table_init(const struct mm_memcache_config *config)
 		nentries_increment *= 2;
 
 	// Initialize the table.
+	mc_table.access = config->access;
+	mc_table.ops = mc_action_ops_select(config->access, config->combiner_spin);
 	mc_table.parts = mm_shared_calloc(nparts, sizeof(struct mc_tpart));
 	mc_table.nparts = nparts;
 	mc_table.part_bits = nbits;
 	mc_table.part_mask = nparts - 1;
-	mc_table.volume_max = volume;
+	mc_table.volume_min = volume / MC_TABLE_REBALANCE_SHRINK;
+	mc_table.volume_cap = volume_cap;
+	mc_table.volume_step = volume / MC_TABLE_REBALANCE_STEP;
+	mc_table.expiry_wheel = config->expiry_wheel;
+	mc_table.combiner_sort = config->combiner_sort;
+	mc_table.rebalance_lock = (mm_task_lock_t) MM_TASK_LOCK_INIT;
+	mc_table.rebalance_time = 0;
 	mc_table.nbuckets_max = nbuckets_max;
 	mc_table.nentries_max = nentries_max;
 	mc_table.nentries_increment = nentries_increment;
 	mc_table.buckets_base = buckets_base;
 	mc_table.entries_base = entries_base;
+	mc_table_init_stamps();
+	mc_epoch_init();
 
 	// Initialize the table partitions.
-#if ENABLE_MEMCACHE_DELEGATE
-	mm_core_t index = 0;
-	ASSERT(nparts <= mm_core_getnum());
-	for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
-		if (mm_bitset_test(&mc_config.affinity, core)) {
-			mc_table_init_part(index++, core);
+	if (config->access == MC_ACCESS_DELEGATE) {
+		mm_core_t index = 0;
+		ASSERT(nparts <= mm_core_getnum());
+		for (mm_core_t core = 0; core < mm_core_getnum(); core++) {
+			if (index == nparts)
+				break;
+			if (mm_bitset_test(&config->affinity, core))
+				mc_table_init_part(index++, core);
 		}
+	} else {
+		for (mm_core_t index = 0; index < nparts; index++)
+			mc_table_init_part(index, MM_CORE_NONE);
 	}
-#else
-	for (mm_core_t index = 0; index < nparts; index++) {
-		mc_table_init_part(index, MM_CORE_NONE);
-	}
-#endif
 
 	LEAVE();
 }
@@ -433,6 +705,20 @@ mc_table_term(void)
 				mm_chunk_destroy_chain(mm_link_head(&entry->chunks));
 			}
 		}
+		while (!mm_queue_empty(&part->retired)) {
+			struct mm_link *link = mm_queue_delete_head(&part->retired);
+			struct mc_entry *entry = containerof(link, struct mc_entry, link);
+			mm_chunk_destroy_chain(mm_link_head(&entry->chunks));
+		}
+	}
+
+	// Free the partition combiners and expiration wheels.
+	for (mm_core_t p = 0; p < mc_table.nparts; p++) {
+		struct mc_tpart *part = &mc_table.parts[p];
+		if (part->combiner != NULL)
+			mm_task_combiner_destroy(part->combiner);
+		if (part->wheel != NULL)
+			mm_shared_free(part->wheel);
 	}
 
 	// Free the table partitions.
@@ -22,15 +22,19 @@
 
 #include "memcache/memcache.h"
 #include "memcache/entry.h"
+#include "memcache/wheel.h"
 
+#include "core/core.h"
 #include "core/wait.h"
 
 #include "base/bitops.h"
 #include "base/list.h"
+#include "base/lock.h"
+#include "base/mem/cdata.h"
 
-#if ENABLE_MEMCACHE_LOCKING
-# include "base/lock.h"
-#endif
+/* Forward declarations. */
+struct mc_action_ops;
+struct mm_task_combiner;
 
 /* A partition of table of memcache entries. */
 struct mc_tpart
@@ -47,6 +51,9 @@ struct mc_tpart
 
 	/* The list of unused entries. */
 	struct mm_link free_list;
+	/* The list of removed entries that might still be read by
+	   commands in progress, in the order of retirement epochs. */
+	struct mm_queue retired;
 
 	/* The number of buckets. */
 	uint32_t nbuckets;
@@ -54,33 +61,54 @@ struct mc_tpart
 	uint32_t nentries;
 	uint32_t nentries_void;
 	uint32_t nentries_free;
+	uint32_t nentries_retired;
 
 	/* The total data size of all entries. */
 	size_t volume;
+	/* The data size of retired entries. It is updated with the
+	   free list lock and counts against the volume limit too. */
+	size_t volume_retired;
+	/* The data size that causes data eviction. */
+	size_t volume_max;
+
+	/* Access statistics for volume rebalancing. These are updated
+	   without synchronization so they are only approximate. The hits
+	   are counted per core so that lookups share no cache line. */
+	MM_CDATA(uint64_t, nhits);
+	uint64_t nevicted;
+	/* The statistics at the last rebalancing. */
+	uint64_t nhits_last;
+	uint64_t nevicted_last;
 
 	struct mm_waitset waitset;
 
-#if ENABLE_MEMCACHE_COMBINER
-	struct mm_combiner *combiner;
-#elif ENABLE_MEMCACHE_DELEGATE
+	/* Combiner access. */
+	struct mm_task_combiner *combiner;
+	/* Delegate access (the owner core) or MM_CORE_NONE. */
 	mm_core_t core;
-#elif ENABLE_MEMCACHE_LOCKING
-	mm_task_lock_t lookup_lock;
+	/* Locking access. */
+	mm_task_rwlock_t lookup_lock;
 	mm_task_lock_t freelist_lock;
-#endif
 
 	bool evicting;
 	bool striding;
 
-	/* The last used value for CAS command. */
-	uint64_t stamp;
-	uint64_t flush_stamp;
+	/* The entries with smaller stamps are flushed. */
+	mm_atomic_uint64_t flush_stamp;
+
+	/* The entries with expiration time or NULL if not indexed. */
+	struct mc_wheel *wheel;
 
 } __align_cacheline;
 
 /* The table of memcache entries. */
 struct mc_table
 {
+	/* The table access method. */
+	mc_access_t access;
+	/* The table actions specialized for the access method. */
+	const struct mc_action_ops *ops;
+
 	/* Table partitions. */
 	struct mc_tpart *parts;
 	/* The number of table partitions. */
@@ -96,12 +124,29 @@ struct mc_table
 	uint32_t nentries_max;
 	/* The number of entries added on expansion. */
 	uint32_t nentries_increment;
-	/* The data size per partition that causes data eviction. */
-	size_t volume_max;
+	/* The limits for the partition data size. */
+	size_t volume_min;
+	size_t volume_cap;
+	/* The data size moved between partitions at once. */
+	size_t volume_step;
+
+	/* Index entries by expiration time. */
+	bool expiry_wheel;
+	/* Order combiner batches by table buckets. */
+	bool combiner_sort;
+
+	/* Volume rebalancing state. */
+	mm_task_lock_t rebalance_lock;
+	mm_timeval_t rebalance_time;
 
 	/* Base table addresses. */
 	void *buckets_base;
 	void *entries_base;
+
+	/* The stamp time origin. */
+	mm_timeval_t stamp_base;
+	/* The number of stamp bits that identify the core. */
+	uint16_t stamp_core_bits;
 };
 
 extern struct mc_table mc_table;
@@ -125,6 +170,13 @@ mc_table_part(uint32_t hash)
 	return &mc_table.parts[hash & mc_table.part_mask];
 }
 
+/* The current time in seconds as used for entry expiration. */
+static inline uint32_t
+mc_table_time(void)
+{
+	return mm_core->time_manager.real_time / 1000000;
+}
+
 static inline uint32_t
 mc_table_index(struct mc_tpart *part, uint32_t hash)
 {
@@ -141,46 +193,65 @@ mc_table_index(struct mc_tpart *part, uint32_t hash)
 	return index;
 }
 
+/*
+ * Partition locks. The locking argument is a constant in each of the
+ * table action variants so the check folds away at compile time.
+ */
+
+static inline void
+mc_table_lookup_lock(struct mc_tpart *part, bool locking)
+{
+	if (locking)
+		mm_task_write_lock(&part->lookup_lock);
+}
+
+static inline void
+mc_table_lookup_unlock(struct mc_tpart *part, bool locking)
+{
+	if (locking)
+		mm_task_write_unlock(&part->lookup_lock);
+}
+
 static inline void
-mc_table_lookup_lock(struct mc_tpart *part)
+mc_table_lookup_read_lock(struct mc_tpart *part, bool locking)
 {
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	mm_task_lock(&part->lookup_lock);
-#else
-	(void) part;
-#endif
+	if (locking)
+		mm_task_read_lock(&part->lookup_lock);
 }
 
 static inline void
-mc_table_lookup_unlock(struct mc_tpart *part)
+mc_table_lookup_read_unlock(struct mc_tpart *part, bool locking)
 {
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	mm_task_unlock(&part->lookup_lock);
-#else
-	(void) part;
-#endif
+	if (locking)
+		mm_task_read_unlock(&part->lookup_lock);
 }
 
 static inline void
-mc_table_freelist_lock(struct mc_tpart *part)
+mc_table_freelist_lock(struct mc_tpart *part, bool locking)
 {
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	mm_task_lock(&part->freelist_lock);
-#else
-	(void) part;
-#endif
+	if (locking)
+		mm_task_lock(&part->freelist_lock);
 }
 
 static inline void
-mc_table_freelist_unlock(struct mc_tpart *part)
+mc_table_freelist_unlock(struct mc_tpart *part, bool locking)
 {
-#if ENABLE_SMP && ENABLE_MEMCACHE_LOCKING
-	mm_task_unlock(&part->freelist_lock);
-#else
-	(void) part;
-#endif
+	if (locking)
+		mm_task_unlock(&part->freelist_lock);
 }
 
+/*
+ * Entry stamps (CAS values) are unique across the table. A stamp is made
+ * of its creation time, a per-core sequence number for stamps created in
+ * the same microsecond, and the core number. So making a stamp needs no
+ * shared state, and the stamps of different cores still order by time.
+ */
+
+uint64_t mc_table_stamp(void);
+
+/* Get a stamp that is above every stamp made before the call. */
+uint64_t mc_table_flush_stamp(void);
+
 void mc_table_buckets_resize(struct mc_tpart *part,
 			     uint32_t old_nbuckets,
 			     uint32_t new_nbuckets)
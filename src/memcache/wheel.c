@@ -0,0 +1,111 @@
+/*
+ * memcache/wheel.c - MainMemory memcache expiration wheel.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memcache/wheel.h"
+
+#include "base/log/trace.h"
+
+void
+mc_wheel_prepare(struct mc_wheel *wheel, uint32_t time)
+{
+	ENTER();
+
+	wheel->time = time;
+	wheel->nentries = 0;
+
+	for (uint32_t i = 0; i < MC_WHEEL_SLOTS; i++) {
+		mm_list_init(&wheel->seconds[i]);
+		mm_list_init(&wheel->minutes[i]);
+	}
+	mm_list_init(&wheel->later);
+
+	LEAVE();
+}
+
+static void
+mc_wheel_place(struct mc_wheel *wheel, struct mc_entry *entry)
+{
+	uint32_t exp_time = entry->exp_time;
+	uint32_t time = wheel->time;
+
+	struct mm_list *list;
+	if (exp_time <= time)
+		list = &wheel->seconds[time & MC_WHEEL_MASK];
+	else if ((exp_time >> MC_WHEEL_BITS) == (time >> MC_WHEEL_BITS))
+		list = &wheel->seconds[exp_time & MC_WHEEL_MASK];
+	else if ((exp_time >> (2 * MC_WHEEL_BITS)) == (time >> (2 * MC_WHEEL_BITS)))
+		list = &wheel->minutes[(exp_time >> MC_WHEEL_BITS) & MC_WHEEL_MASK];
+	else
+		list = &wheel->later;
+
+	mm_list_append(list, &entry->expiry);
+}
+
+// Place again the entries of a list that the wheel has reached.
+static void
+mc_wheel_cascade(struct mc_wheel *wheel, struct mm_list *list)
+{
+	if (mm_list_empty(list))
+		return;
+
+	struct mm_list entries;
+	mm_list_init(&entries);
+	mm_list_splice(&entries, mm_list_head(list), mm_list_tail(list));
+	mm_list_init(list);
+
+	while (!mm_list_empty(&entries)) {
+		struct mm_list *link = mm_list_delete_head(&entries);
+		struct mc_entry *entry = containerof(link, struct mc_entry, expiry);
+		mc_wheel_place(wheel, entry);
+	}
+}
+
+void
+mc_wheel_insert(struct mc_wheel *wheel, struct mc_entry *entry)
+{
+	ASSERT(entry->exp_time != 0);
+	wheel->nentries++;
+	mc_wheel_place(wheel, entry);
+}
+
+struct mc_entry *
+mc_wheel_expired(struct mc_wheel *wheel, uint32_t time)
+{
+	while (wheel->time <= time) {
+		// Every entry in the current slot has already expired.
+		struct mm_list *slot = &wheel->seconds[wheel->time & MC_WHEEL_MASK];
+		if (!mm_list_empty(slot))
+			return containerof(mm_list_head(slot), struct mc_entry, expiry);
+
+		// Advance to the next second unless there is nothing at all.
+		if (wheel->nentries == 0) {
+			wheel->time = time + 1;
+			break;
+		}
+		wheel->time++;
+
+		if ((wheel->time & MC_WHEEL_MASK) == 0) {
+			uint32_t span = wheel->time >> MC_WHEEL_BITS;
+			if ((span & MC_WHEEL_MASK) == 0)
+				mc_wheel_cascade(wheel, &wheel->later);
+			mc_wheel_cascade(wheel, &wheel->minutes[span & MC_WHEEL_MASK]);
+		}
+	}
+	return NULL;
+}
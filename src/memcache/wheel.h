@@ -0,0 +1,76 @@
+/*
+ * memcache/wheel.h - MainMemory memcache expiration wheel.
+ *
+ * Copyright (C) 2014  Aleksey Demakov
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMCACHE_WHEEL_H
+#define MEMCACHE_WHEEL_H
+
+#include "memcache/memcache.h"
+#include "memcache/entry.h"
+
+#include "base/list.h"
+
+/*
+ * A hierarchical timing wheel that indexes table entries by expiration
+ * time. The first level has a slot for every second of the current
+ * 64-second span, the second level has a slot for every such span of
+ * the current 4096-second span, everything beyond that is kept in a
+ * single list. Entries move to a lower level as the wheel reaches their
+ * span so every entry is touched at most three times before expiration.
+ */
+
+#define MC_WHEEL_BITS		6
+#define MC_WHEEL_SLOTS		(1u << MC_WHEEL_BITS)
+#define MC_WHEEL_MASK		(MC_WHEEL_SLOTS - 1)
+
+struct mc_wheel
+{
+	/* The second that is going to expire next. */
+	uint32_t time;
+
+	/* The number of entries in the wheel. */
+	uint32_t nentries;
+
+	/* Entries that expire within the current 64 seconds. */
+	struct mm_list seconds[MC_WHEEL_SLOTS];
+	/* Entries that expire within the current 4096 seconds. */
+	struct mm_list minutes[MC_WHEEL_SLOTS];
+	/* Entries that expire later. */
+	struct mm_list later;
+};
+
+void mc_wheel_prepare(struct mc_wheel *wheel, uint32_t time)
+	__attribute__((nonnull(1)));
+
+void mc_wheel_insert(struct mc_wheel *wheel, struct mc_entry *entry)
+	__attribute__((nonnull(1, 2)));
+
+/* Get an entry that has expired by the given time or NULL if none. The
+   entry stays in the wheel until removed. */
+struct mc_entry * mc_wheel_expired(struct mc_wheel *wheel, uint32_t time)
+	__attribute__((nonnull(1)));
+
+static inline void
+mc_wheel_remove(struct mc_wheel *wheel, struct mc_entry *entry)
+{
+	ASSERT(wheel->nentries);
+	wheel->nentries--;
+	mm_list_delete(&entry->expiry);
+}
+
+#endif /* MEMCACHE_WHEEL_H */
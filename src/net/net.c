@@ -728,8 +728,14 @@ mm_net_spawn_writer(struct mm_net_socket *sock)
 		// Submit a writer work.
 		mm_core_post_work(sock->event.core, &sock->write_work);
 
-		// Let it start immediately.
-		mm_task_yield();
+		// If the writer is spawned by the socket reader then let it
+		// run after the readers of the other sockets from the same
+		// event batch as these are already in the work queue. So the
+		// core handles input for all the ready sockets back-to-back
+		// and then transmits output for all of them. Otherwise let
+		// the writer start immediately.
+		if (sock->reader != mm_task_self())
+			mm_task_yield();
 	}
 
 leave:
@@ -1084,7 +1090,7 @@ mm_net_create_inet6_server(const char *name,
 }
 
 void
-mm_net_set_server_affinity(struct mm_net_server *srv, struct mm_bitset *mask)
+mm_net_set_server_affinity(struct mm_net_server *srv, const struct mm_bitset *mask)
 {
 	ENTER();
 
@@ -187,7 +187,7 @@ struct mm_net_server *mm_net_create_inet6_server(const char *name,
                                                  const char *addrstr, uint16_t port)
 	__attribute__((nonnull(1, 2, 3)));
 
-void mm_net_set_server_affinity(struct mm_net_server *srv, struct mm_bitset *mask)
+void mm_net_set_server_affinity(struct mm_net_server *srv, const struct mm_bitset *mask)
 	__attribute__((nonnull(1, 2)));
 
 void mm_net_start_server(struct mm_net_server *srv)
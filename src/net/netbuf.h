@@ -64,6 +64,30 @@ mm_netbuf_write_reset(struct mm_netbuf_socket *sock)
 	mm_buffer_rectify(&sock->tbuf);
 }
 
+static inline bool
+mm_netbuf_write_empty(struct mm_netbuf_socket *sock)
+{
+	return mm_buffer_empty(&sock->tbuf);
+}
+
+static inline size_t
+mm_netbuf_write_size(struct mm_netbuf_socket *sock)
+{
+	return mm_buffer_getsize(&sock->tbuf);
+}
+
+static inline void
+mm_netbuf_read_release(struct mm_netbuf_socket *sock)
+{
+	mm_buffer_release(&sock->rbuf);
+}
+
+static inline void
+mm_netbuf_write_release(struct mm_netbuf_socket *sock)
+{
+	mm_buffer_release(&sock->tbuf);
+}
+
 static inline void
 mm_netbuf_demand(struct mm_netbuf_socket *sock, size_t size)
 {
@@ -123,6 +147,12 @@ mm_netbuf_splice(struct mm_netbuf_socket *sock, char *data, size_t size,
 	mm_buffer_splice(&sock->tbuf, data, size, release, release_data);
 }
 
+static inline void
+mm_netbuf_unsplice(struct mm_netbuf_socket *sock, mm_buffer_release_t release)
+{
+	mm_buffer_unsplice(&sock->tbuf, release);
+}
+
 static inline void
 mm_netbuf_close(struct mm_netbuf_socket *sock)
 {
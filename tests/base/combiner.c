@@ -37,5 +37,11 @@ main(int ac, char **av)
 	g_combiner = mm_combiner_create(execute, g_ring_size, g_handoff);
 	test1(NULL, routine);
 	printf("nexec: %zu\n", g_nexec);
+	printf("passes: %llu\n", (unsigned long long) g_combiner->stat.npasses);
+	printf("batch: %.2f avg, %llu max\n",
+	       g_combiner->stat.npasses
+	       ? (double) g_combiner->stat.nrequests / g_combiner->stat.npasses : 0.0,
+	       (unsigned long long) g_combiner->stat.nbatch_max);
+	printf("handoffs: %llu\n", (unsigned long long) g_combiner->stat.nhandoffs);
 	return EXIT_SUCCESS;
 }
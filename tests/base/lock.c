@@ -7,6 +7,8 @@
 #include <stdlib.h>
 
 mm_thread_lock_t g_lock = MM_THREAD_LOCK_INIT;
+mm_ticket_lock_t g_ticket_lock = MM_TICKET_LOCK_INIT;
+mm_mcs_lock_t g_mcs_lock = MM_MCS_LOCK_INIT;
 size_t g_nexec = 0;
 
 void
@@ -18,13 +20,37 @@ execute(void *arg __attribute__((unused)))
 	mm_thread_unlock(&g_lock);
 }
 
+void
+execute_ticket(void *arg __attribute__((unused)))
+{
+	mm_ticket_lock(&g_ticket_lock);
+	delay_consumer();
+	g_nexec++;
+	mm_ticket_unlock(&g_ticket_lock);
+}
+
+void
+execute_mcs(void *arg __attribute__((unused)))
+{
+	struct mm_mcs_node node;
+	mm_mcs_lock(&g_mcs_lock, &node);
+	delay_consumer();
+	g_nexec++;
+	mm_mcs_unlock(&g_mcs_lock, &node);
+}
+
 void
 routine(void *arg __attribute__((unused)))
 {
+	void (*exec)(void *) =
+		g_lock_kind == LOCK_TICKET ? execute_ticket :
+			g_lock_kind == LOCK_MCS ? execute_mcs :
+				execute;
+
 	size_t i;
 	for (i = 0; i < g_consumer_data_size; i++) {
 		delay_producer();
-		execute(NULL);
+		exec(NULL);
 	}
 }
 
@@ -0,0 +1,138 @@
+#include "core/core.h"
+#include "core/msgport.h"
+#include "core/task.h"
+
+#include "base/util/exit.h"
+
+#include "params.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_SENDERS	64
+#define BATCH_SIZE	32
+
+struct payload
+{
+	uint32_t sender;
+	uint32_t seq;
+};
+
+struct mm_msgport *g_port;
+
+// The number of senders that have sent all their messages.
+mm_atomic_uint32_t g_ndone;
+
+// The number of sends that ran out of credits per sender.
+unsigned long g_nblocked[MAX_SENDERS];
+
+// The next expected message number per sender.
+uint32_t g_next[MAX_SENDERS];
+
+unsigned long g_nreceived = 0;
+unsigned long g_nbatches = 0;
+unsigned long g_nerrors = 0;
+uint64_t g_time;
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+mm_value_t
+sender(mm_value_t arg)
+{
+	uint32_t index = arg;
+
+	for (unsigned long i = 0; i < g_producer_data_size; i++) {
+		struct mm_msg *msg = mm_msg_create(sizeof(struct payload));
+		struct payload *payload = (struct payload *) msg->data;
+		payload->sender = index;
+		payload->seq = i;
+
+		// Fall back to blocking when out of credits.
+		if (!mm_msgport_send(g_port, msg)) {
+			g_nblocked[index]++;
+			mm_msgport_send_blocking(g_port, msg);
+		}
+	}
+
+	mm_atomic_uint32_inc(&g_ndone);
+	return 0;
+}
+
+mm_value_t
+receiver(mm_value_t arg __attribute__((unused)))
+{
+	g_port = mm_msgport_create(mm_task_self(), g_ring_size, g_producers > 1);
+
+	uint64_t start = now();
+	for (int i = 0; i < g_producers; i++)
+		mm_core_post((i + 1) % mm_core_getnum(), sender, i);
+
+	unsigned long total = g_producer_data_size * g_producers;
+	while (g_nreceived < total) {
+		struct mm_msg *msgs[BATCH_SIZE];
+		uint32_t n = mm_msgport_receive_blocking(g_port, msgs, BATCH_SIZE);
+		for (uint32_t i = 0; i < n; i++) {
+			// Every sender's messages must arrive in order.
+			struct payload *payload = (struct payload *) msgs[i]->data;
+			if (msgs[i]->size != sizeof(struct payload)
+			    || payload->sender >= (uint32_t) g_producers
+			    || payload->seq != g_next[payload->sender]++)
+				g_nerrors++;
+			mm_msg_destroy(msgs[i]);
+		}
+		g_nreceived += n;
+		g_nbatches++;
+	}
+	g_time = now() - start;
+
+	// The senders might still touch the port after their last send.
+	while (mm_memory_load(g_ndone) != (uint32_t) g_producers)
+		mm_task_yield();
+	mm_msgport_destroy(g_port);
+
+	mm_core_stop();
+	mm_exit_set();
+	return 0;
+}
+
+void
+start(void)
+{
+	mm_core_post(0, receiver, 0);
+}
+
+int
+main(int ac, char **av)
+{
+	set_params(ac, av, TEST_MSGPORT);
+	if (g_producers > MAX_SENDERS) {
+		fprintf(stderr, "too many senders\n");
+		return EXIT_FAILURE;
+	}
+
+	mm_core_init();
+	mm_core_hook_start(start);
+	mm_core_start();
+	mm_core_term();
+
+	unsigned long nblocked = 0;
+	for (int i = 0; i < g_producers; i++)
+		nblocked += g_nblocked[i];
+
+	printf("time: %u.%06u\n",
+	       (unsigned) (g_time / 1000000000),
+	       (unsigned) (g_time % 1000000000 / 1000));
+	printf("received: %lu\n", g_nreceived);
+	printf("batch: %.2f avg\n",
+	       g_nbatches ? (double) g_nreceived / g_nbatches : 0.0);
+	printf("blocked sends: %lu\n", nblocked);
+	printf("errors: %lu\n", g_nerrors);
+	return g_nerrors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -14,6 +14,14 @@ int g_consumers = DEFAULT_CONSUMERS;
 
 int g_handoff = DEFAULT_HANDOFF;
 
+int g_lock_kind = LOCK_TATAS;
+
+static const char *g_lock_names[] = {
+	[LOCK_TATAS] = "tatas",
+	[LOCK_TICKET] = "ticket",
+	[LOCK_MCS] = "mcs",
+};
+
 #if !TEST_STATIC_RING
 int g_ring_size = DEFAULT_RING_SIZE;
 #endif
@@ -55,6 +63,14 @@ usage(char *prog_name, char *message)
 			" [-c <concurrency>]"
 			" [-e <producer-delay>]"
 			" [-d <consumer-delay>]"
+			" [-l tatas|ticket|mcs]"
+			" [-n <repeat-count>]\n",
+			prog_name);
+	else if (g_test == TEST_MSGPORT)
+		fprintf(stderr,
+			"Usage:\n\t%s"
+			" [-p <senders>]"
+			" [-r <port-size>]"
 			" [-n <repeat-count>]\n",
 			prog_name);
 	else
@@ -85,21 +101,34 @@ getnum(char *prog_name, const char *s, int is_int, int allow_zero)
 	return value;
 }
 
+static int
+getlock(char *prog_name, const char *s)
+{
+	for (size_t i = 0; i < sizeof g_lock_names / sizeof g_lock_names[0]; i++) {
+		if (strcmp(s, g_lock_names[i]) == 0)
+			return i;
+	}
+	usage(prog_name, "invalid lock kind");
+	return LOCK_TATAS;
+}
+
 void
 set_params(int ac, char **av, int test)
 {
-	static const char *lock_options = ":c:n:e:d:";
+	static const char *lock_options = ":c:n:e:d:l:";
 #if TEST_STATIC_RING
 	static const char *ring_options = ":p:c:n:e:d:o";
 #else
 	static const char *ring_options = ":p:c:r:n:e:d:o";
 #endif
 	static const char *combiner_options = ":c:r:f:n:e:d:";
+	static const char *msgport_options = ":p:r:n:";
 
 	const char *options =
 		test == TEST_LOCK ? lock_options :
 			test == TEST_RING ? ring_options :
-				combiner_options;
+				test == TEST_MSGPORT ? msgport_options :
+					combiner_options;
 	int c;
 
 	g_test = test;
@@ -111,6 +140,9 @@ set_params(int ac, char **av, int test)
 		case 'c':
 			g_consumers = getnum(av[0], optarg, 1, 0);
 			break;
+		case 'l':
+			g_lock_kind = getlock(av[0], optarg);
+			break;
 		case 'f':
 			g_handoff = getnum(av[0], optarg, 1, 0);
 			break;
@@ -163,11 +195,23 @@ set_params(int ac, char **av, int test)
 		g_consumer_data_size = g_data_size / g_consumers;
 		fprintf(stderr,
 			"concurrency: %d\n"
+			"lock kind: %s\n"
 			"repeat count: %lu\n"
 			"producer delay: %lu\n"
 			"consumer delay: %lu\n",
-			g_consumers, g_data_size,
+			g_consumers, g_lock_names[g_lock_kind],
+			g_data_size,
 			g_producer_delay, g_consumer_delay);
+	} else if (test == TEST_MSGPORT) {
+		if (RING_SIZE < 2)
+			usage(av[0], "port size must be at least two");
+
+		g_producer_data_size = g_data_size / g_producers;
+		fprintf(stderr,
+			"senders: %d\n"
+			"port size: %d\n"
+			"repeat count: %lu\n",
+			g_producers, RING_SIZE, g_data_size);
 	} else {
 		g_consumer_data_size = g_data_size / g_consumers;
 		fprintf(stderr,
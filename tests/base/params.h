@@ -4,6 +4,13 @@ enum {
 	TEST_LOCK,
 	TEST_RING,
 	TEST_COMBINER,
+	TEST_MSGPORT,
+};
+
+enum {
+	LOCK_TATAS,
+	LOCK_TICKET,
+	LOCK_MCS,
 };
 
 #define DEFAULT_PRODUCERS	4
@@ -22,6 +29,8 @@ extern int g_consumers;
 
 extern int g_handoff;
 
+extern int g_lock_kind;
+
 #ifndef TEST_STATIC_RING
 # define TEST_STATIC_RING	0
 #endif
@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 
 #define _1M_	1000000
@@ -55,8 +56,7 @@ thread_runner(void *arg)
 
 #if ENABLE_LOCK_STATS
 	g_this_thread = thr;
-	thr->lock_stat.lock_count = 0;
-	thr->lock_stat.fail_count = 0;
+	memset(&thr->lock_stat, 0, sizeof thr->lock_stat);
 #endif
 
 	mm_barrier_local_init(&thr->barrier);
@@ -0,0 +1,612 @@
+#include "common.h"
+#include "base/barrier.h"
+
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DEFAULT_HOST		"127.0.0.1"
+#define DEFAULT_PORT		11211
+
+#define DEFAULT_THREADS		2
+#define DEFAULT_CONNECTIONS	16
+#define DEFAULT_DEPTH		1
+#define DEFAULT_KEYS		10000
+#define DEFAULT_VALUE_SIZE	64
+#define DEFAULT_GET_RATIO	90
+#define DEFAULT_REQUESTS	((unsigned long) 1000 * 1000)
+
+#define KEY_FORMAT		"key:%lu"
+#define REQUEST_OVERHEAD	64
+
+// Latency histogram: 16 linear sub-buckets for every power of two.
+#define HIST_SUB_BITS		4
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_SIZE		(64 * HIST_SUB)
+
+static const char *g_host = DEFAULT_HOST;
+static int g_port = DEFAULT_PORT;
+
+static int g_threads = DEFAULT_THREADS;
+static int g_connections = DEFAULT_CONNECTIONS;
+static int g_depth = DEFAULT_DEPTH;
+static unsigned long g_keys = DEFAULT_KEYS;
+static double g_zipf = 0.0;
+static unsigned long g_value_size = DEFAULT_VALUE_SIZE;
+static int g_get_ratio = DEFAULT_GET_RATIO;
+static unsigned long g_requests = DEFAULT_REQUESTS;
+static int g_populate = 0;
+
+static char *g_value;
+
+static struct mm_barrier g_barrier;
+
+struct request
+{
+	uint64_t time;
+	int get;
+};
+
+struct connection
+{
+	int fd;
+
+	// Outstanding requests.
+	struct request *requests;
+	int head;
+	int count;
+
+	// Output buffer.
+	char *obuf;
+	size_t osize;
+	size_t opos;
+	size_t olen;
+
+	// Input buffer.
+	char *ibuf;
+	size_t isize;
+	size_t ipos;
+	size_t ilen;
+};
+
+struct thread
+{
+	pthread_t thread;
+	struct mm_barrier_local barrier;
+
+	int index;
+	uint64_t seed;
+
+	int nconns;
+	struct connection *conns;
+
+	unsigned long nrequests;
+	unsigned long nsent;
+	unsigned long nreceived;
+	unsigned long nhits;
+	unsigned long nmisses;
+	unsigned long nerrors;
+
+	uint64_t time;
+	uint64_t hist[HIST_SIZE];
+};
+
+/**********************************************************************
+ * Helper routines.
+ **********************************************************************/
+
+void
+usage(char *prog_name, char *message)
+{
+	char *slash = strrchr(prog_name, '/');
+	if (slash != NULL && *(slash + 1))
+		prog_name = slash + 1;
+
+	if (message != NULL)
+		fprintf(stderr, "%s: %s\n", prog_name, message);
+
+	fprintf(stderr,
+		"Usage:\n\t%s"
+		" [-h <host>]"
+		" [-p <port>]"
+		" [-t <threads>]"
+		" [-c <connections>]"
+		" [-d <pipeline-depth>]"
+		" [-k <key-space>]"
+		" [-z <zipf-skew>]"
+		" [-s <value-size>]"
+		" [-r <get-ratio-percent>]"
+		" [-n <request-count>]"
+		" [-f]\n",
+		prog_name);
+
+	exit(EXIT_FAILURE);
+}
+
+static void
+set_params(int ac, char **av)
+{
+	int c;
+	while ((c = getopt (ac, av, ":h:p:t:c:d:k:z:s:r:n:f")) != -1) {
+		switch (c) {
+		case 'h':
+			g_host = optarg;
+			break;
+		case 'p':
+			g_port = getnum(av[0], optarg, 1, 0);
+			break;
+		case 't':
+			g_threads = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'c':
+			g_connections = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'd':
+			g_depth = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'k':
+			g_keys = getnum(av[0], optarg, 0, 0);
+			break;
+		case 'z':
+			g_zipf = getreal(av[0], optarg);
+			break;
+		case 's':
+			g_value_size = getnum(av[0], optarg, 0, 1);
+			break;
+		case 'r':
+			g_get_ratio = getnum(av[0], optarg, 1, 1);
+			break;
+		case 'n':
+			g_requests = getnum(av[0], optarg, 0, 0);
+			break;
+		case 'f':
+			g_populate = 1;
+			break;
+		case ':':
+			usage(av[0], "missing option value");
+		default:
+			usage(av[0], "invalid option");
+		}
+	}
+
+	if (g_get_ratio > 100)
+		usage(av[0], "get ratio must not exceed 100");
+	if (g_connections < g_threads)
+		g_threads = g_connections;
+
+	fprintf(stderr,
+		"server: %s:%d\n"
+		"threads: %d\n"
+		"connections: %d\n"
+		"pipeline depth: %d\n"
+		"key space: %lu\n"
+		"key distribution: %s (%.2f)\n"
+		"value size: %lu\n"
+		"get ratio: %d%%\n"
+		"request count: %lu\n"
+		"populate: %s\n",
+		g_host, g_port,
+		g_threads, g_connections, g_depth,
+		g_keys, g_zipf > 0.0 ? "zipf" : "uniform", g_zipf,
+		g_value_size, g_get_ratio, g_requests,
+		g_populate ? "yes" : "no");
+}
+
+/**********************************************************************
+ * Latency histogram.
+ **********************************************************************/
+
+static unsigned
+hist_bucket(uint64_t value)
+{
+	if (value < HIST_SUB)
+		return value;
+	unsigned shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + ((value >> shift) & (HIST_SUB - 1));
+}
+
+static uint64_t
+hist_value(unsigned bucket)
+{
+	if (bucket < HIST_SUB)
+		return bucket;
+	unsigned shift = bucket / HIST_SUB - 1;
+	uint64_t sub = bucket % HIST_SUB;
+	return ((HIST_SUB + sub + 1) << shift) - 1;
+}
+
+static uint64_t
+hist_percentile(uint64_t *hist, uint64_t count, double percent)
+{
+	uint64_t rank = (uint64_t) (count * percent / 100.0);
+	uint64_t sum = 0;
+	for (unsigned i = 0; i < HIST_SIZE; i++) {
+		sum += hist[i];
+		if (sum > rank)
+			return hist_value(i);
+	}
+	return hist_value(HIST_SIZE - 1);
+}
+
+/**********************************************************************
+ * Connection handling.
+ **********************************************************************/
+
+static void
+conn_open(struct connection *conn)
+{
+	conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (conn->fd < 0) {
+		perror("socket()");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(g_port);
+	if (inet_pton(AF_INET, g_host, &addr.sin_addr) != 1) {
+		fprintf(stderr, "invalid host address: %s\n", g_host);
+		exit(EXIT_FAILURE);
+	}
+
+	if (connect(conn->fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+		perror("connect()");
+		exit(EXIT_FAILURE);
+	}
+
+	int val = 1;
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof val);
+	fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+	size_t size = g_depth * (g_value_size + REQUEST_OVERHEAD);
+	conn->requests = xalloc(g_depth * sizeof(struct request));
+	conn->osize = size;
+	conn->obuf = xalloc(conn->osize);
+	conn->isize = size + 4096;
+	conn->ibuf = xalloc(conn->isize);
+}
+
+static void
+conn_close(struct connection *conn)
+{
+	close(conn->fd);
+	free(conn->requests);
+	free(conn->obuf);
+	free(conn->ibuf);
+}
+
+// Append a request to the output buffer, return false if there is no
+// room for it until more output is sent.
+static bool
+conn_request(struct thread *thr, struct connection *conn,
+	     unsigned long key, int get)
+{
+	// Move the unsent output left after a partial write to the front.
+	if (conn->opos) {
+		memmove(conn->obuf, conn->obuf + conn->opos,
+			conn->olen - conn->opos);
+		conn->olen -= conn->opos;
+		conn->opos = 0;
+	}
+	if (conn->osize - conn->olen < g_value_size + REQUEST_OVERHEAD)
+		return false;
+
+	char *p = conn->obuf + conn->olen;
+	size_t n = conn->osize - conn->olen;
+
+	int len;
+	if (get) {
+		len = snprintf(p, n, "get " KEY_FORMAT "\r\n", key);
+	} else {
+		len = snprintf(p, n, "set " KEY_FORMAT " 0 0 %lu\r\n",
+			       key, g_value_size);
+		memcpy(p + len, g_value, g_value_size);
+		len += g_value_size;
+		memcpy(p + len, "\r\n", 2);
+		len += 2;
+	}
+	conn->olen += len;
+
+	int tail = (conn->head + conn->count) % g_depth;
+	conn->requests[tail].time = now();
+	conn->requests[tail].get = get;
+	conn->count++;
+
+	thr->nsent++;
+	return true;
+}
+
+static void
+conn_send(struct thread *thr, struct connection *conn)
+{
+	while (conn->opos < conn->olen) {
+		ssize_t n = write(conn->fd, conn->obuf + conn->opos,
+				  conn->olen - conn->opos);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			perror("write()");
+			thr->nerrors++;
+			exit(EXIT_FAILURE);
+		}
+		conn->opos += n;
+	}
+	conn->opos = 0;
+	conn->olen = 0;
+}
+
+// Find a complete line in the input buffer.
+static char *
+conn_line(struct connection *conn, size_t pos)
+{
+	char *s = conn->ibuf + pos;
+	char *e = conn->ibuf + conn->ilen;
+	for (; s + 1 < e; s++) {
+		if (s[0] == '\r' && s[1] == '\n')
+			return s + 2;
+	}
+	return NULL;
+}
+
+// Try to consume a complete response, return false if more input
+// is needed.
+static bool
+conn_response(struct thread *thr, struct connection *conn)
+{
+	char *start = conn->ibuf + conn->ipos;
+	char *end = conn_line(conn, conn->ipos);
+	if (end == NULL)
+		return false;
+
+	struct request *req = &conn->requests[conn->head];
+	if (req->get && strncmp(start, "VALUE ", 6) == 0) {
+		// Skip the key and flags and get the value size.
+		unsigned long bytes;
+		char key[256];
+		unsigned flags;
+		if (sscanf(start, "VALUE %255s %u %lu", key, &flags, &bytes) != 3) {
+			fprintf(stderr, "invalid response\n");
+			exit(EXIT_FAILURE);
+		}
+		size_t pos = (end - conn->ibuf) + bytes + 2;
+		if (pos > conn->ilen)
+			return false;
+		end = conn_line(conn, pos);
+		if (end == NULL)
+			return false;
+		thr->nhits++;
+	} else if (req->get && strncmp(start, "END\r\n", 5) == 0) {
+		thr->nmisses++;
+	} else if (!req->get && strncmp(start, "STORED\r\n", 8) == 0) {
+		// Nothing to do.
+	} else {
+		thr->nerrors++;
+	}
+
+	thr->hist[hist_bucket((now() - req->time) / 1000)]++;
+	thr->nreceived++;
+
+	conn->head = (conn->head + 1) % g_depth;
+	conn->count--;
+	conn->ipos = end - conn->ibuf;
+	return true;
+}
+
+static void
+conn_receive(struct thread *thr, struct connection *conn)
+{
+	for (;;) {
+		// Make room for more input.
+		if (conn->ipos > 0) {
+			memmove(conn->ibuf, conn->ibuf + conn->ipos,
+				conn->ilen - conn->ipos);
+			conn->ilen -= conn->ipos;
+			conn->ipos = 0;
+		}
+		if (conn->ilen == conn->isize) {
+			conn->isize *= 2;
+			conn->ibuf = realloc(conn->ibuf, conn->isize);
+			if (conn->ibuf == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		ssize_t n = read(conn->fd, conn->ibuf + conn->ilen,
+				 conn->isize - conn->ilen);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			perror("read()");
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) {
+			fprintf(stderr, "connection closed by server\n");
+			exit(EXIT_FAILURE);
+		}
+		conn->ilen += n;
+
+		while (conn->count && conn_response(thr, conn))
+			;
+	}
+}
+
+/**********************************************************************
+ * Load generation.
+ **********************************************************************/
+
+static void
+run_load(struct thread *thr, unsigned long nrequests, int populate)
+{
+	struct pollfd *fds = xalloc(thr->nconns * sizeof(struct pollfd));
+	unsigned long key = thr->index;
+
+	while (thr->nreceived < nrequests) {
+		// Fill up the connection pipelines.
+		for (int i = 0; i < thr->nconns; i++) {
+			struct connection *conn = &thr->conns[i];
+			while (conn->count < g_depth && thr->nsent < nrequests) {
+				if (populate) {
+					// Store every key of the thread's share.
+					if (!conn_request(thr, conn, key, 0))
+						break;
+					key += g_threads;
+				} else {
+					int get = (int) (rand_next(&thr->seed) % 100) < g_get_ratio;
+					if (!conn_request(thr, conn, next_key(&thr->seed), get))
+						break;
+				}
+			}
+			conn_send(thr, conn);
+		}
+
+		for (int i = 0; i < thr->nconns; i++) {
+			struct connection *conn = &thr->conns[i];
+			fds[i].fd = conn->fd;
+			fds[i].events = POLLIN | (conn->olen ? POLLOUT : 0);
+			fds[i].revents = 0;
+		}
+		if (poll(fds, thr->nconns, 1000) < 0 && errno != EINTR) {
+			perror("poll()");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < thr->nconns; i++) {
+			struct connection *conn = &thr->conns[i];
+			if (fds[i].revents & POLLOUT)
+				conn_send(thr, conn);
+			if (fds[i].revents & (POLLIN | POLLERR | POLLHUP))
+				conn_receive(thr, conn);
+		}
+	}
+
+	free(fds);
+}
+
+static void *
+thread_runner(void *arg)
+{
+	struct thread *thr = arg;
+
+	for (int i = 0; i < thr->nconns; i++)
+		conn_open(&thr->conns[i]);
+
+	mm_barrier_local_init(&thr->barrier);
+
+	if (g_populate) {
+		unsigned long n = g_keys / g_threads;
+		if ((unsigned long) thr->index < g_keys % g_threads)
+			n++;
+		run_load(thr, n, 1);
+
+		// Reset the counters.
+		thr->nsent = 0;
+		thr->nreceived = 0;
+		thr->nhits = 0;
+		thr->nmisses = 0;
+		thr->nerrors = 0;
+		memset(thr->hist, 0, sizeof thr->hist);
+	}
+
+	mm_barrier_wait(&g_barrier, &thr->barrier);
+
+	uint64_t start = now();
+	run_load(thr, thr->nrequests, 0);
+	thr->time = now() - start;
+
+	for (int i = 0; i < thr->nconns; i++)
+		conn_close(&thr->conns[i]);
+
+	return NULL;
+}
+
+int
+main(int ac, char **av)
+{
+	set_params(ac, av);
+	keys_init(g_keys, g_zipf);
+
+	g_value = xalloc(g_value_size + 1);
+	memset(g_value, 'x', g_value_size);
+
+	struct thread *tt = xalloc(g_threads * sizeof(struct thread));
+	for (int i = 0; i < g_threads; i++) {
+		struct thread *thr = &tt[i];
+		thr->index = i;
+		thr->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+		thr->nconns = g_connections / g_threads;
+		if (i < g_connections % g_threads)
+			thr->nconns++;
+		thr->conns = xalloc(thr->nconns * sizeof(struct connection));
+		thr->nrequests = g_requests / g_threads;
+		if ((unsigned long) i < g_requests % g_threads)
+			thr->nrequests++;
+	}
+
+	mm_barrier_init(&g_barrier, g_threads);
+	for (int i = 0; i < g_threads; i++) {
+		if (pthread_create(&tt[i].thread, NULL, thread_runner, &tt[i])) {
+			fprintf(stderr, "failed to create a thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (int i = 0; i < g_threads; i++)
+		pthread_join(tt[i].thread, NULL);
+
+	// Collect and print stats.
+	static uint64_t hist[HIST_SIZE];
+	uint64_t time = 0, count = 0;
+	unsigned long nhits = 0, nmisses = 0, nerrors = 0;
+	for (int i = 0; i < g_threads; i++) {
+		struct thread *thr = &tt[i];
+		for (unsigned j = 0; j < HIST_SIZE; j++)
+			hist[j] += thr->hist[j];
+		if (time < thr->time)
+			time = thr->time;
+		count += thr->nreceived;
+		nhits += thr->nhits;
+		nmisses += thr->nmisses;
+		nerrors += thr->nerrors;
+		free(thr->conns);
+	}
+
+	printf("requests: %llu\n", (unsigned long long) count);
+	printf("get hits: %lu\n", nhits);
+	printf("get misses: %lu\n", nmisses);
+	printf("errors: %lu\n", nerrors);
+	printf("time: %u.%06u\n",
+	       (unsigned) (time / 1000000000),
+	       (unsigned) (time % 1000000000 / 1000));
+	printf("throughput: %.0f req/s\n",
+	       time ? count * 1e9 / time : 0.0);
+	printf("latency p50: %llu us\n",
+	       (unsigned long long) hist_percentile(hist, count, 50.0));
+	printf("latency p90: %llu us\n",
+	       (unsigned long long) hist_percentile(hist, count, 90.0));
+	printf("latency p99: %llu us\n",
+	       (unsigned long long) hist_percentile(hist, count, 99.0));
+	printf("latency p99.9: %llu us\n",
+	       (unsigned long long) hist_percentile(hist, count, 99.9));
+
+	free(tt);
+	free(g_value);
+	keys_term();
+
+	return EXIT_SUCCESS;
+}
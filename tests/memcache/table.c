@@ -0,0 +1,421 @@
+#include "memcache/command.h"
+#include "memcache/hotkey.h"
+#include "memcache/table.h"
+
+#include "core/combiner.h"
+#include "core/core.h"
+#include "core/task.h"
+
+#include "base/log/plain.h"
+#include "base/mem/buffer.h"
+#include "base/util/exit.h"
+
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_KEYS		((unsigned long) 100 * 1000)
+#define DEFAULT_VALUE_SIZE	64
+#define DEFAULT_READ_RATIO	90
+#define DEFAULT_OPERATIONS	((unsigned long) 10 * 1000 * 1000)
+#define DEFAULT_PARTITIONS	1
+#define DEFAULT_TASKS		1
+
+// Leave some core workers for the table maintenance.
+#define MAX_TASKS		128
+
+#define KEY_FORMAT		"key:%lu"
+
+static int g_cores = 0;
+static int g_tasks = DEFAULT_TASKS;
+static unsigned long g_keys = DEFAULT_KEYS;
+static double g_zipf = 0.0;
+static unsigned long g_value_size = DEFAULT_VALUE_SIZE;
+static int g_read_ratio = DEFAULT_READ_RATIO;
+static unsigned long g_operations = DEFAULT_OPERATIONS;
+static int g_partitions = DEFAULT_PARTITIONS;
+static mc_access_t g_access = MC_ACCESS_DEFAULT;
+static bool g_futures = false;
+static unsigned long g_ttl = 0;
+static bool g_wheel = false;
+static bool g_sort = false;
+static bool g_spin = false;
+
+static char *g_value;
+
+static mm_atomic_uint32_t g_ready;
+static mm_atomic_uint32_t g_running;
+
+static struct mm_memcache_config g_config;
+
+struct bench
+{
+	mm_core_t core;
+	unsigned long index;
+
+	uint64_t seed;
+
+	// The value source for set commands.
+	struct mm_buffer_segment seg;
+
+	unsigned long nops;
+	unsigned long nreads;
+	unsigned long nhits;
+	unsigned long nwrites;
+
+	uint64_t time;
+};
+
+static struct bench *g_benches;
+static int g_nbenches;
+
+// Combiner statistics summed up for all partitions.
+static struct mm_combiner_stat g_combiner_stat;
+
+/**********************************************************************
+ * Helper routines.
+ **********************************************************************/
+
+void
+usage(char *prog_name, char *message)
+{
+	char *slash = strrchr(prog_name, '/');
+	if (slash != NULL && *(slash + 1))
+		prog_name = slash + 1;
+
+	if (message != NULL)
+		fprintf(stderr, "%s: %s\n", prog_name, message);
+
+	fprintf(stderr,
+		"Usage:\n\t%s"
+		" [-m locking|combiner|delegate]"
+		" [-f]"
+		" [-g]"
+		" [-y]"
+		" [-c <cores>]"
+		" [-j <tasks-per-core>]"
+		" [-p <partitions>]"
+		" [-k <key-space>]"
+		" [-z <zipf-skew>]"
+		" [-s <value-size>]"
+		" [-r <read-ratio-percent>]"
+		" [-n <operation-count>]"
+		" [-t <ttl-seconds>]"
+		" [-w]\n",
+		prog_name);
+
+	exit(EXIT_FAILURE);
+}
+
+static const char *
+access_name(mc_access_t access)
+{
+	switch (access) {
+	case MC_ACCESS_LOCKING:
+		return "locking";
+	case MC_ACCESS_COMBINER:
+		return "combiner";
+	case MC_ACCESS_DELEGATE:
+		return "delegate";
+	default:
+		return "unknown";
+	}
+}
+
+static mc_access_t
+getaccess(char *prog_name, const char *s)
+{
+	for (mc_access_t access = MC_ACCESS_LOCKING; access <= MC_ACCESS_DELEGATE; access++) {
+		if (strcmp(s, access_name(access)) == 0)
+			return access;
+	}
+	usage(prog_name, "invalid access mode");
+}
+
+static void
+set_params(int ac, char **av)
+{
+	int c;
+	while ((c = getopt (ac, av, ":m:fgyc:j:p:k:z:s:r:n:t:w")) != -1) {
+		switch (c) {
+		case 'm':
+			g_access = getaccess(av[0], optarg);
+			break;
+		case 'f':
+			g_futures = true;
+			break;
+		case 'g':
+			g_sort = true;
+			break;
+		case 'y':
+			g_spin = true;
+			break;
+		case 'c':
+			g_cores = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'j':
+			g_tasks = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'p':
+			g_partitions = getnum(av[0], optarg, 1, 0);
+			break;
+		case 'k':
+			g_keys = getnum(av[0], optarg, 0, 0);
+			break;
+		case 'z':
+			g_zipf = getreal(av[0], optarg);
+			break;
+		case 's':
+			g_value_size = getnum(av[0], optarg, 0, 1);
+			break;
+		case 'r':
+			g_read_ratio = getnum(av[0], optarg, 1, 1);
+			break;
+		case 'n':
+			g_operations = getnum(av[0], optarg, 0, 0);
+			break;
+		case 't':
+			g_ttl = getnum(av[0], optarg, 0, 1);
+			break;
+		case 'w':
+			g_wheel = true;
+			break;
+		case ':':
+			usage(av[0], "missing option value");
+		default:
+			usage(av[0], "invalid option");
+		}
+	}
+
+	if (g_read_ratio > 100)
+		usage(av[0], "read ratio must not exceed 100");
+	if (g_tasks > MAX_TASKS)
+		usage(av[0], "too many tasks per core");
+}
+
+static void
+print_params(void)
+{
+	fprintf(stderr,
+		"access mode: %s%s\n"
+		"cores: %d\n"
+		"tasks per core: %d\n"
+		"partitions: %d\n"
+		"key space: %lu\n"
+		"key distribution: %s (%.2f)\n"
+		"value size: %lu\n"
+		"read ratio: %d%%\n"
+		"operation count: %lu\n"
+		"ttl: %lu%s\n",
+		access_name(g_access),
+		g_access == MC_ACCESS_DELEGATE ? (g_futures ? " (futures)" : " (rings)")
+		: g_access == MC_ACCESS_COMBINER
+		? (g_sort ? (g_spin ? " (sorted, spin)" : " (sorted)")
+			  : (g_spin ? " (spin)" : "")) : "",
+		g_cores, g_tasks, g_partitions,
+		g_keys, g_zipf > 0.0 ? "zipf" : "uniform", g_zipf,
+		g_value_size, g_read_ratio, g_operations,
+		g_ttl, g_wheel ? " (expiry wheel)" : "");
+}
+
+/**********************************************************************
+ * Table access.
+ **********************************************************************/
+
+static mc_result_t
+execute(struct bench *bench, struct mc_command_type *type, unsigned long key)
+{
+	char buf[32];
+	int len = snprintf(buf, sizeof buf, KEY_FORMAT, key);
+
+	struct mc_command *command = mc_command_create(bench->core);
+	command->type = type;
+	command->action.key = buf;
+	command->action.key_len = len;
+	if (type->kind == MC_COMMAND_STORAGE) {
+		command->params.set.seg = &bench->seg;
+		command->params.set.start = bench->seg.data;
+		command->params.set.bytes = g_value_size;
+		if (g_ttl)
+			command->params.set.exptime = mc_table_time() + g_ttl;
+	}
+
+	mc_command_execute(command);
+	mc_result_t rc = mc_command_result(command);
+
+	mc_command_destroy(bench->core, command);
+	return rc;
+}
+
+static mm_value_t
+bench_routine(mm_value_t arg)
+{
+	struct bench *bench = (struct bench *) arg;
+
+	// Populate the table with the task's share of the keys.
+	for (unsigned long key = bench->index; key < g_keys; key += g_nbenches)
+		execute(bench, &mc_desc_set, key);
+
+	// Wait for all the tasks. A core might run a few of them so let
+	// the others proceed.
+	mm_atomic_uint32_dec(&g_ready);
+	while (mm_memory_load(g_ready) != 0)
+		mm_task_yield();
+
+	uint64_t start = now();
+	for (unsigned long i = 0; i < bench->nops; i++) {
+		unsigned long key = next_key(&bench->seed);
+		if ((int) (rand_next(&bench->seed) % 100) < g_read_ratio) {
+			if (execute(bench, &mc_desc_get, key) == MC_RESULT_ENTRY)
+				bench->nhits++;
+			bench->nreads++;
+		} else {
+			execute(bench, &mc_desc_set, key);
+			bench->nwrites++;
+		}
+	}
+	bench->time = now() - start;
+
+	// The last task to finish stops the run.
+	if (mm_atomic_uint32_dec_and_test(&g_running) == 0) {
+		mm_core_stop();
+		mm_exit_set();
+	}
+
+	return 0;
+}
+
+/**********************************************************************
+ * Benchmark start and stop.
+ **********************************************************************/
+
+static void
+bench_start(void)
+{
+	mc_table_init(&g_config);
+	mc_hotkey_start();
+	mc_command_start(&g_config);
+
+	g_ready = g_nbenches;
+	g_running = g_nbenches;
+	for (int i = 0; i < g_nbenches; i++)
+		mm_core_post(g_benches[i].core, bench_routine, (mm_value_t) &g_benches[i]);
+}
+
+static void
+bench_stop(void)
+{
+	for (mm_core_t p = 0; p < mc_table.nparts; p++) {
+		struct mm_task_combiner *combiner = mc_table.parts[p].combiner;
+		if (combiner == NULL)
+			continue;
+		struct mm_combiner_stat *stat = &combiner->combiner.stat;
+		g_combiner_stat.npasses += stat->npasses;
+		g_combiner_stat.nrequests += stat->nrequests;
+		g_combiner_stat.nhandoffs += stat->nhandoffs;
+		if (g_combiner_stat.nbatch_max < stat->nbatch_max)
+			g_combiner_stat.nbatch_max = stat->nbatch_max;
+	}
+
+	mc_command_stop();
+	mc_hotkey_stop();
+	mc_table_term();
+}
+
+static void
+print_results(void)
+{
+	uint64_t time = 0, total_time = 0;
+	unsigned long nops = 0, nreads = 0, nhits = 0, nwrites = 0;
+	for (int i = 0; i < g_nbenches; i++) {
+		struct bench *bench = &g_benches[i];
+		printf("task #%02d: %u.%06u\n", i,
+		       (unsigned) (bench->time / 1000000000),
+		       (unsigned) (bench->time % 1000000000 / 1000));
+		if (time < bench->time)
+			time = bench->time;
+		total_time += bench->time;
+		nops += bench->nops;
+		nreads += bench->nreads;
+		nhits += bench->nhits;
+		nwrites += bench->nwrites;
+	}
+
+	printf("operations: %lu\n", nops);
+	printf("reads: %lu\n", nreads);
+	printf("read hits: %lu\n", nhits);
+	printf("writes: %lu\n", nwrites);
+	printf("time: %u.%06u\n",
+	       (unsigned) (time / 1000000000),
+	       (unsigned) (time % 1000000000 / 1000));
+	printf("throughput: %.0f ops/s\n", time ? nops * 1e9 / time : 0.0);
+	// Every task runs one operation at a time.
+	printf("latency: %.0f ns/op\n", nops ? (double) total_time / nops : 0.0);
+
+	if (g_combiner_stat.npasses) {
+		printf("combiner passes: %llu\n",
+		       (unsigned long long) g_combiner_stat.npasses);
+		printf("combiner batch: %.2f avg, %llu max\n",
+		       (double) g_combiner_stat.nrequests / g_combiner_stat.npasses,
+		       (unsigned long long) g_combiner_stat.nbatch_max);
+		printf("combiner handoffs: %llu\n",
+		       (unsigned long long) g_combiner_stat.nhandoffs);
+	}
+}
+
+int
+main(int ac, char **av)
+{
+	set_params(ac, av);
+
+	mm_core_init();
+	if (g_cores == 0 || g_cores > mm_core_getnum())
+		g_cores = mm_core_getnum();
+	print_params();
+	keys_init(g_keys, g_zipf);
+
+	g_value = xalloc(g_value_size + 1);
+	g_nbenches = g_cores * g_tasks;
+	g_benches = xalloc(g_nbenches * sizeof(struct bench));
+	memset(g_value, 'x', g_value_size);
+
+	for (int i = 0; i < g_nbenches; i++) {
+		struct bench *bench = &g_benches[i];
+		bench->core = i % g_cores;
+		bench->index = i;
+		bench->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+		bench->seg.data = g_value;
+		bench->seg.size = g_value_size;
+		bench->nops = g_operations / g_nbenches;
+		if ((unsigned long) i < g_operations % g_nbenches)
+			bench->nops++;
+	}
+
+	g_config.volume = MC_TABLE_VOLUME_DEFAULT;
+	g_config.access = g_access;
+	g_config.delegate_futures = g_futures;
+	g_config.expiry_wheel = g_wheel;
+	g_config.combiner_sort = g_sort;
+	g_config.combiner_spin = g_spin;
+	g_config.nparts = g_partitions;
+	mm_bitset_prepare(&g_config.affinity, &mm_global_arena, mm_core_getnum());
+	for (int i = 0; i < g_partitions && i < mm_core_getnum(); i++)
+		mm_bitset_set(&g_config.affinity, i);
+
+	mm_core_hook_start(bench_start);
+	mm_core_hook_stop(bench_stop);
+
+	mm_core_start();
+	mm_core_term();
+
+	print_results();
+
+	free(g_benches);
+	free(g_value);
+	keys_term();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,123 @@
+#include "util.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static unsigned long g_nkeys;
+
+// Cumulative distribution for Zipf key selection.
+static double *g_zipf_cdf;
+
+/**********************************************************************
+ * Helper routines.
+ **********************************************************************/
+
+unsigned long
+getnum(char *prog_name, const char *s, int is_int, int allow_zero)
+{
+	char *end;
+	unsigned long value = strtoul(s, &end, 0);
+	if (*end != 0)
+		usage(prog_name, "invalid value");
+	if (value == 0 && !allow_zero)
+		usage(prog_name, "invalid value");
+	if (is_int && value != (unsigned long) ((long) ((int) value)))
+		usage(prog_name, "too large value ");
+	return value;
+}
+
+double
+getreal(char *prog_name, const char *s)
+{
+	char *end;
+	double value = strtod(s, &end);
+	if (*end != 0 || value < 0.0)
+		usage(prog_name, "invalid value");
+	return value;
+}
+
+void *
+xalloc(size_t size)
+{
+	void *ptr = calloc(1, size);
+	if (ptr == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t
+rand_next(uint64_t *seed)
+{
+	// The xorshift64* generator.
+	uint64_t x = *seed;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*seed = x;
+	return x * 2685821657736338717ull;
+}
+
+double
+rand_real(uint64_t *seed)
+{
+	return (rand_next(seed) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**********************************************************************
+ * Key selection.
+ **********************************************************************/
+
+void
+keys_init(unsigned long nkeys, double zipf)
+{
+	g_nkeys = nkeys;
+	if (zipf <= 0.0)
+		return;
+
+	g_zipf_cdf = xalloc(nkeys * sizeof(double));
+
+	double sum = 0.0;
+	for (unsigned long i = 0; i < nkeys; i++) {
+		sum += 1.0 / pow((double) (i + 1), zipf);
+		g_zipf_cdf[i] = sum;
+	}
+	for (unsigned long i = 0; i < nkeys; i++)
+		g_zipf_cdf[i] /= sum;
+}
+
+void
+keys_term(void)
+{
+	free(g_zipf_cdf);
+	g_zipf_cdf = NULL;
+}
+
+unsigned long
+next_key(uint64_t *seed)
+{
+	if (g_zipf_cdf == NULL)
+		return rand_next(seed) % g_nkeys;
+
+	double r = rand_real(seed);
+	unsigned long lo = 0, hi = g_nkeys - 1;
+	while (lo < hi) {
+		unsigned long mid = (lo + hi) / 2;
+		if (g_zipf_cdf[mid] < r)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -0,0 +1,22 @@
+#include "common.h"
+
+/* Print the program usage and exit. Every program defines its own. */
+void usage(char *prog_name, char *message)
+	__attribute__((noreturn));
+
+unsigned long getnum(char *prog_name, const char *s, int is_int, int allow_zero);
+double getreal(char *prog_name, const char *s);
+
+void * xalloc(size_t size);
+
+/* Monotonic time in nanoseconds. */
+uint64_t now(void);
+
+/* The xorshift64* random generator. */
+uint64_t rand_next(uint64_t *seed);
+double rand_real(uint64_t *seed);
+
+/* Key selection with uniform or Zipf distribution. */
+void keys_init(unsigned long nkeys, double zipf);
+void keys_term(void);
+unsigned long next_key(uint64_t *seed);